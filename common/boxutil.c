@@ -13,3 +13,24 @@ int box_intersect_line_rough(const BoxRec *b, const xSegment *seg)
 
 	return TRUE;
 }
+
+/*
+ * Regions are y-x banded: boxes are sorted by y, and all boxes in a
+ * band share the same y1/y2.  Find the first box whose band ends
+ * below y, which is the first box which can contain line y.
+ */
+const BoxRec *box_band_search(const BoxRec *box, int n, int y)
+{
+	while (n > 0) {
+		int half = n / 2;
+
+		if (box[half].y2 <= y) {
+			box += half + 1;
+			n -= half + 1;
+		} else {
+			n = half;
+		}
+	}
+
+	return box;
+}
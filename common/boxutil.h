@@ -45,5 +45,6 @@ static inline int box_area(BoxPtr box)
 }
 
 int box_intersect_line_rough(const BoxRec *b, const xSegment *seg);
+const BoxRec *box_band_search(const BoxRec *box, int n, int y);
 
 #endif
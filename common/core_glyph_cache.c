@@ -0,0 +1,286 @@
+/*
+ * Core font glyph cache.
+ *
+ * Core text (PolyText/ImageText) glyphs are bitmaps.  Rather than
+ * rendering them with the CPU, we keep them in an atlas of 1bpp
+ * bitmaps which can be used as a monochrome source by the GPU.
+ *
+ * Glyphs are allocated to the atlas using a simple shelf allocator.
+ * When the atlas (or the lookup table) is full, the entire cache is
+ * reset; glyph uploads are queued on the GPU behind any outstanding
+ * rendering which uses the old contents, so no synchronisation with
+ * the GPU is required.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xf86.h"
+#include "fb.h"
+#include "compat-api.h"
+
+#include "core_glyph_cache.h"
+#include "utils.h"
+
+#define CORE_GLYPH_HASH_SIZE	4096
+#define CORE_GLYPH_HASH_MAX	(CORE_GLYPH_HASH_SIZE * 3 / 4)
+#define CORE_GLYPH_SHELF_ALIGN	4
+#define CORE_GLYPH_MAX_SHELVES	(CORE_GLYPH_ATLAS_HEIGHT / CORE_GLYPH_SHELF_ALIGN)
+#define CORE_GLYPH_UPLOAD_BATCH	64
+
+struct core_glyph_entry {
+	FontPtr font;
+	CharInfoPtr pci;
+	xPoint pos;
+};
+
+struct core_glyph_shelf {
+	uint16_t y;
+	uint16_t height;
+	uint16_t x;		/* in 32-bit words */
+};
+
+struct core_glyph_cache_priv {
+	CloseScreenProcPtr CloseScreen;
+	UnrealizeFontProcPtr UnrealizeFont;
+	core_glyph_upload_t upload;
+	unsigned usage_hint;
+	PixmapPtr atlas;
+	unsigned num_entries;
+	unsigned num_shelves;
+	unsigned shelf_top;
+	struct core_glyph_shelf shelves[CORE_GLYPH_MAX_SHELVES];
+	struct core_glyph_entry entries[CORE_GLYPH_HASH_SIZE];
+};
+
+static DevPrivateKeyRec core_glyph_cache_key;
+
+static struct core_glyph_cache_priv *core_glyph_cache_get_priv(ScreenPtr pScreen)
+{
+	return dixGetPrivate(&pScreen->devPrivates, &core_glyph_cache_key);
+}
+
+static void core_glyph_cache_set_priv(ScreenPtr pScreen,
+	struct core_glyph_cache_priv *priv)
+{
+	dixSetPrivate(&pScreen->devPrivates, &core_glyph_cache_key, priv);
+}
+
+static void core_glyph_cache_reset(struct core_glyph_cache_priv *priv)
+{
+	memset(priv->entries, 0, sizeof(priv->entries));
+	priv->num_entries = 0;
+	priv->num_shelves = 0;
+	priv->shelf_top = 0;
+}
+
+static unsigned core_glyph_hash(FontPtr pFont, CharInfoPtr pci)
+{
+	uintptr_t key = (uintptr_t)pci ^ ((uintptr_t)pFont >> 4);
+
+	return ((uint32_t)(key >> 2) * 2654435761U) >> 20;
+}
+
+static struct core_glyph_entry *core_glyph_lookup(
+	struct core_glyph_cache_priv *priv, FontPtr pFont, CharInfoPtr pci)
+{
+	unsigned i = core_glyph_hash(pFont, pci);
+
+	for (;; i = (i + 1) & (CORE_GLYPH_HASH_SIZE - 1)) {
+		struct core_glyph_entry *e = &priv->entries[i];
+
+		if (!e->pci || (e->pci == pci && e->font == pFont))
+			return e;
+	}
+}
+
+static Bool core_glyph_alloc(struct core_glyph_cache_priv *priv,
+	unsigned words, unsigned height, xPoint *pos)
+{
+	struct core_glyph_shelf *shelf;
+	unsigned i;
+
+	height = ALIGN(height, CORE_GLYPH_SHELF_ALIGN);
+
+	for (i = 0; i < priv->num_shelves; i++) {
+		shelf = &priv->shelves[i];
+
+		if (shelf->height == height &&
+		    shelf->x + words <= CORE_GLYPH_ATLAS_WIDTH)
+			goto found;
+	}
+
+	if (priv->shelf_top + height > CORE_GLYPH_ATLAS_HEIGHT)
+		return FALSE;
+
+	shelf = &priv->shelves[priv->num_shelves++];
+	shelf->y = priv->shelf_top;
+	shelf->height = height;
+	shelf->x = 0;
+	priv->shelf_top += height;
+
+ found:
+	pos->x = shelf->x * 32;
+	pos->y = shelf->y;
+	shelf->x += words;
+
+	return TRUE;
+}
+
+static void core_glyph_cache_fini(ScreenPtr pScreen)
+{
+	struct core_glyph_cache_priv *priv = core_glyph_cache_get_priv(pScreen);
+
+	if (priv->atlas)
+		pScreen->DestroyPixmap(priv->atlas);
+	core_glyph_cache_set_priv(pScreen, NULL);
+	free(priv);
+}
+
+static Bool core_glyph_cache_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
+{
+	struct core_glyph_cache_priv *priv = core_glyph_cache_get_priv(pScreen);
+
+	pScreen->CloseScreen = priv->CloseScreen;
+	pScreen->UnrealizeFont = priv->UnrealizeFont;
+
+	core_glyph_cache_fini(pScreen);
+
+	return pScreen->CloseScreen(CLOSE_SCREEN_ARGS);
+}
+
+/*
+ * When a font goes away, its CharInfo structures are freed, and their
+ * addresses may be reused by a new font.  Drop the cache contents if
+ * we hold any glyphs from this font.
+ */
+static Bool core_glyph_cache_UnrealizeFont(ScreenPtr pScreen, FontPtr pFont)
+{
+	struct core_glyph_cache_priv *priv = core_glyph_cache_get_priv(pScreen);
+	unsigned i;
+	Bool ret;
+
+	for (i = 0; i < CORE_GLYPH_HASH_SIZE; i++) {
+		if (priv->entries[i].pci && priv->entries[i].font == pFont) {
+			core_glyph_cache_reset(priv);
+			break;
+		}
+	}
+
+	pScreen->UnrealizeFont = priv->UnrealizeFont;
+	ret = pScreen->UnrealizeFont(pScreen, pFont);
+	priv->UnrealizeFont = pScreen->UnrealizeFont;
+	pScreen->UnrealizeFont = core_glyph_cache_UnrealizeFont;
+
+	return ret;
+}
+
+Bool core_glyph_cache_init(ScreenPtr pScreen, core_glyph_upload_t upload,
+	unsigned usage_hint)
+{
+	struct core_glyph_cache_priv *priv;
+
+	if (!dixRegisterPrivateKey(&core_glyph_cache_key, PRIVATE_SCREEN, 0))
+		return FALSE;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return FALSE;
+
+	priv->upload = upload;
+	priv->usage_hint = usage_hint;
+
+	core_glyph_cache_set_priv(pScreen, priv);
+
+	priv->CloseScreen = pScreen->CloseScreen;
+	pScreen->CloseScreen = core_glyph_cache_CloseScreen;
+	priv->UnrealizeFont = pScreen->UnrealizeFont;
+	pScreen->UnrealizeFont = core_glyph_cache_UnrealizeFont;
+
+	return TRUE;
+}
+
+/*
+ * Ensure that all glyphs in this run are present in the atlas, and
+ * return their positions.  Returns the atlas pixmap, or NULL if the
+ * run can not be cached.
+ */
+PixmapPtr core_glyph_cache_preload(ScreenPtr pScreen, FontPtr pFont,
+	unsigned nglyph, CharInfoPtr *ppci, xPoint *pos)
+{
+	struct core_glyph_cache_priv *priv = core_glyph_cache_get_priv(pScreen);
+	struct core_glyph_upload uploads[CORE_GLYPH_UPLOAD_BATCH];
+	unsigned i, n;
+	Bool reset = FALSE;
+
+	if (!priv)
+		return NULL;
+
+	if (!priv->atlas) {
+		priv->atlas = pScreen->CreatePixmap(pScreen,
+						    CORE_GLYPH_ATLAS_WIDTH,
+						    CORE_GLYPH_ATLAS_HEIGHT,
+						    32, priv->usage_hint);
+		if (!priv->atlas)
+			return NULL;
+	}
+
+ restart:
+	for (i = n = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		struct core_glyph_entry *e;
+		unsigned w = GLYPHWIDTHPIXELS(pci);
+		unsigned h = GLYPHHEIGHTPIXELS(pci);
+
+		if (w == 0 || h == 0) {
+			pos[i].x = pos[i].y = 0;
+			continue;
+		}
+
+		if (w > CORE_GLYPH_MAX_WIDTH || h > CORE_GLYPH_MAX_HEIGHT)
+			return NULL;
+
+		e = core_glyph_lookup(priv, pFont, pci);
+		if (!e->pci) {
+			if (priv->num_entries >= CORE_GLYPH_HASH_MAX ||
+			    !core_glyph_alloc(priv, core_glyph_words(pci), h,
+					      &e->pos)) {
+				/* Only retry a run once with an empty cache */
+				if (reset)
+					return NULL;
+				core_glyph_cache_reset(priv);
+				reset = TRUE;
+				goto restart;
+			}
+
+			e->font = pFont;
+			e->pci = pci;
+			priv->num_entries++;
+
+			uploads[n].pci = pci;
+			uploads[n].pos = e->pos;
+			if (++n >= CORE_GLYPH_UPLOAD_BATCH) {
+				if (!priv->upload(pScreen, priv->atlas,
+						  uploads, n))
+					goto fail;
+				n = 0;
+			}
+		}
+
+		pos[i] = e->pos;
+	}
+
+	if (n && !priv->upload(pScreen, priv->atlas, uploads, n))
+		goto fail;
+
+	return priv->atlas;
+
+ fail:
+	/* The atlas contents are now unknown, so discard everything */
+	core_glyph_cache_reset(priv);
+	return NULL;
+}
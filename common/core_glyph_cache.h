@@ -0,0 +1,35 @@
+#ifndef CORE_GLYPH_CACHE_H
+#define CORE_GLYPH_CACHE_H
+
+#include "dixfontstr.h"
+
+/*
+ * Core font glyphs are held as 1bpp bitmaps in an atlas pixmap.  The
+ * atlas pixmap is a 32bpp pixmap, each pixel of which carries 32
+ * horizontally adjacent glyph bits.  Glyph positions are in bits.
+ */
+#define CORE_GLYPH_ATLAS_WIDTH		256
+#define CORE_GLYPH_ATLAS_HEIGHT		512
+#define CORE_GLYPH_MAX_WIDTH		256
+#define CORE_GLYPH_MAX_HEIGHT		128
+
+struct core_glyph_upload {
+	CharInfoPtr pci;
+	xPoint pos;
+};
+
+typedef Bool (*core_glyph_upload_t)(ScreenPtr, PixmapPtr,
+				    const struct core_glyph_upload *, unsigned);
+
+Bool core_glyph_cache_init(ScreenPtr pScreen, core_glyph_upload_t upload,
+	unsigned usage_hint);
+
+PixmapPtr core_glyph_cache_preload(ScreenPtr pScreen, FontPtr pFont,
+	unsigned nglyph, CharInfoPtr *ppci, xPoint *pos);
+
+static inline unsigned core_glyph_words(CharInfoPtr pci)
+{
+	return (GLYPHWIDTHPIXELS(pci) + 31) / 32;
+}
+
+#endif
@@ -12,31 +12,63 @@
 #include "glyph_cache.h"
 #include "utils.h"
 
+/*
+ * Each glyph format has a set of atlas pages, added as required up to
+ * a memory budget.  Within a page, glyphs are allocated square slots,
+ * which are power-of-two multiples of GLYPH_MIN_SIZE.
+ *
+ * Once all pages are full, slots are reclaimed using a clock: glyphs
+ * which have been used since the clock hand last passed are given a
+ * second chance, and glyphs used by the current request are never
+ * evicted, so preloading a run of glyphs can not evict itself.
+ */
 #define CACHE_PICTURE_SIZE	1024
+#define CACHE_MAX_PAGES		8
+#define CACHE_BUDGET		(16 * 1024 * 1024)
 #define GLYPH_MIN_SIZE		8
-#define GLYPH_MAX_SIZE		64
+#define GLYPH_MAX_SIZE		128
 #define GLYPH_RATIO_SIZE	(GLYPH_MAX_SIZE / GLYPH_MIN_SIZE)
 #define GLYPH_CACHE_SIZE \
 	(CACHE_PICTURE_SIZE * CACHE_PICTURE_SIZE / \
 	 (GLYPH_MIN_SIZE * GLYPH_MIN_SIZE))
+#define GLYPH_UPLOAD_BATCH	64
 
-struct glyph_cache {
+struct glyph_page {
 	PicturePtr picture;
 	GlyphPtr *glyphs;
-	uint16_t count, evict;
+	unsigned count;
+};
+
+struct glyph_cache {
+	struct glyph_page page[CACHE_MAX_PAGES];
+	unsigned num_pages, max_pages;
+	unsigned hand_page, hand;
+	PictFormatPtr format;
+	unsigned usage_hint;
 	glyph_upload_t upload;
+	unsigned long hits, uploads, evictions;
 };
 
 struct glyph_cache_priv {
 	CloseScreenProcPtr CloseScreen;
+	CARD32 start_time;
+	uint32_t serial;
+	/* Uploads queued for one atlas page */
+	struct glyph_cache *upload_cache;
+	struct glyph_page *upload_page;
+	unsigned num_uploads;
+	struct glyph_upload uploads[GLYPH_UPLOAD_BATCH];
 	unsigned num_caches;
 	struct glyph_cache cache[0];
 };
 
 struct glyph_priv {
 	struct glyph_cache *cache;
+	struct glyph_page *page;
 	xPoint pos;
+	uint32_t serial;
 	uint16_t size, index;
+	Bool referenced;
 };
 
 static DevPrivateKeyRec glyph_key;
@@ -86,17 +118,78 @@ static PicturePtr create_picture(ScreenPtr pScreen, int width, int height,
 	return picture;
 }
 
+static Bool glyph_cache_add_page(ScreenPtr pScreen, struct glyph_cache *cache)
+{
+	struct glyph_page *page = &cache->page[cache->num_pages];
+	PictFormatPtr pPictFormat = cache->format;
+
+	page->picture = create_picture(pScreen, CACHE_PICTURE_SIZE,
+				       CACHE_PICTURE_SIZE, pPictFormat->depth,
+				       pPictFormat, cache->usage_hint);
+	if (!page->picture)
+		return FALSE;
+
+	ValidatePicture(page->picture);
+
+	page->glyphs = calloc(GLYPH_CACHE_SIZE, sizeof(*page->glyphs));
+	if (!page->glyphs) {
+		FreePicture(page->picture, 0);
+		page->picture = NULL;
+		return FALSE;
+	}
+
+	page->count = 0;
+	cache->num_pages++;
+
+	return TRUE;
+}
+
+static void glyph_cache_stats(ScreenPtr pScreen,
+	struct glyph_cache_priv *priv)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+	CARD32 secs = (GetTimeInMillis() - priv->start_time) / 1000;
+	unsigned i;
+
+	if (!secs)
+		secs = 1;
+
+	for (i = 0; i < priv->num_caches; i++) {
+		struct glyph_cache *cache = &priv->cache[i];
+		unsigned long lookups = cache->hits + cache->uploads;
+
+		if (!lookups)
+			continue;
+
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			   "glyph cache: %u bpp: %lu%% hits, %lu uploads (%lu/s), %lu evictions, %u of %u pages\n",
+			   PIXMAN_FORMAT_BPP(cache->format->format),
+			   cache->hits * 100 / lookups, cache->uploads,
+			   cache->uploads / secs, cache->evictions,
+			   cache->num_pages, cache->max_pages);
+	}
+}
+
 static void glyph_cache_fini(ScreenPtr pScreen)
 {
 	struct glyph_cache_priv *priv = glyph_cache_get_priv(pScreen);
-	unsigned i;
+	unsigned i, j, k;
 
 	for (i = 0; i < priv->num_caches; i++) {
 		struct glyph_cache *cache = &priv->cache[i];
-		if (cache->picture)
-			FreePicture(cache->picture, 0);
-		if (cache->glyphs)
-			free(cache->glyphs);
+
+		for (j = 0; j < cache->num_pages; j++) {
+			struct glyph_page *page = &cache->page[j];
+
+			for (k = 0; k < GLYPH_CACHE_SIZE; k++) {
+				if (page->glyphs[k]) {
+					free(glyph_get_priv(page->glyphs[k]));
+					glyph_set_priv(page->glyphs[k], NULL);
+				}
+			}
+			FreePicture(page->picture, 0);
+			free(page->glyphs);
+		}
 	}
 	glyph_cache_set_priv(pScreen, NULL);
 	free(priv);
@@ -108,6 +201,7 @@ static Bool glyph_cache_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 
 	pScreen->CloseScreen = priv->CloseScreen;
 
+	glyph_cache_stats(pScreen, priv);
 	glyph_cache_fini(pScreen);
 
 	return pScreen->CloseScreen(CLOSE_SCREEN_ARGS);
@@ -133,35 +227,33 @@ Bool glyph_cache_init(ScreenPtr pScreen, glyph_upload_t upload,
 
 	memset(priv, 0, size);
 	priv->num_caches = num_formats;
+	priv->start_time = GetTimeInMillis();
 
 	glyph_cache_set_priv(pScreen, priv);
 
 	for (i = 0; i < priv->num_caches; i++) {
 		struct glyph_cache *cache = &priv->cache[i];
-		PictFormatPtr pPictFormat;
-		PicturePtr picture;
 		unsigned format = formats[i];
 		int depth = PIXMAN_FORMAT_DEPTH(format);
+		size_t page_size;
 
-		pPictFormat = PictureMatchFormat(pScreen, depth, format);
-		if (!pPictFormat)
+		cache->format = PictureMatchFormat(pScreen, depth, format);
+		if (!cache->format)
 			goto fail;
 
-		picture = create_picture(pScreen, CACHE_PICTURE_SIZE,
-					 CACHE_PICTURE_SIZE, depth,
-					 pPictFormat, usage_hint);
-		if (!picture)
-			goto fail;
+		page_size = CACHE_PICTURE_SIZE * CACHE_PICTURE_SIZE *
+			    PIXMAN_FORMAT_BPP(format) / 8;
+		cache->max_pages = CACHE_BUDGET / page_size;
+		if (cache->max_pages < 1)
+			cache->max_pages = 1;
+		else if (cache->max_pages > CACHE_MAX_PAGES)
+			cache->max_pages = CACHE_MAX_PAGES;
 
-		ValidatePicture(picture);
+		cache->usage_hint = usage_hint;
+		cache->upload = upload;
 
-		cache->picture = picture;
-		cache->glyphs = calloc(GLYPH_CACHE_SIZE, sizeof(*cache->glyphs));
-		if (!cache->glyphs)
+		if (!glyph_cache_add_page(pScreen, cache))
 			goto fail;
-
-		cache->evict = rand() % GLYPH_CACHE_SIZE;
-		cache->upload = upload;
 	}
 
 	priv->CloseScreen = pScreen->CloseScreen;
@@ -190,21 +282,18 @@ static unsigned glyph_size_to_mask(unsigned size)
 	return glyph_count_to_mask(glyph_size_to_count(size));
 }
 
-static struct glyph_cache *glyph_get_cache(ScreenPtr pScreen, GlyphPtr pGlyph)
+static struct glyph_cache *glyph_get_cache(struct glyph_cache_priv *priv,
+	ScreenPtr pScreen, GlyphPtr pGlyph)
 {
 	PicturePtr pGlyphPicture;
-	struct glyph_cache_priv *priv = glyph_cache_get_priv(pScreen);
 	unsigned i;
 
-	if (!priv)
-		return NULL;
-
 	pGlyphPicture = GetGlyphPicture(pGlyph, pScreen);
 
 	for (i = 0; i < priv->num_caches; i++) {
 		struct glyph_cache *cache = &priv->cache[i];
 
-		if (PICT_FORMAT_RGB(cache->picture->format) ==
+		if (PICT_FORMAT_RGB(cache->format->format) ==
 		    PICT_FORMAT_RGB(pGlyphPicture->format))
 			return cache;
 	}
@@ -212,9 +301,172 @@ static struct glyph_cache *glyph_get_cache(ScreenPtr pScreen, GlyphPtr pGlyph)
 	return NULL;
 }
 
-static struct glyph_priv *__glyph_cache(ScreenPtr pScreen, GlyphPtr pGlyph)
+/*
+ * Find the slots occupied by the glyphs covering a block: either a
+ * larger glyph containing the block, or the glyphs within the block.
+ */
+static void glyph_block_range(struct glyph_page *page, unsigned size,
+	unsigned *index, unsigned *count)
+{
+	unsigned s;
+
+	for (s = size * 2; s <= GLYPH_MAX_SIZE; s *= 2) {
+		unsigned i = *index & glyph_size_to_mask(s);
+		GlyphPtr glyph = page->glyphs[i];
+
+		if (glyph && glyph_get_priv(glyph)->size >= s) {
+			*index = i;
+			*count = glyph_size_to_count(glyph_get_priv(glyph)->size);
+			return;
+		}
+	}
+
+	*count = glyph_size_to_count(size);
+}
+
+/*
+ * Check whether a block can be reclaimed, giving referenced glyphs
+ * their second chance.
+ */
+static Bool glyph_block_busy(struct glyph_page *page, unsigned size,
+	unsigned index, uint32_t serial)
+{
+	unsigned i, count;
+	Bool busy = FALSE;
+
+	glyph_block_range(page, size, &index, &count);
+
+	for (i = index; i < index + count; i++) {
+		struct glyph_priv *priv;
+
+		if (!page->glyphs[i])
+			continue;
+
+		priv = glyph_get_priv(page->glyphs[i]);
+		if (priv->serial == serial)
+			return TRUE;
+
+		if (priv->referenced) {
+			priv->referenced = FALSE;
+			busy = TRUE;
+		}
+	}
+
+	return busy;
+}
+
+static void glyph_block_evict(struct glyph_cache *cache,
+	struct glyph_page *page, unsigned size, unsigned index)
+{
+	unsigned i, count;
+
+	glyph_block_range(page, size, &index, &count);
+
+	for (i = index; i < index + count; i++) {
+		GlyphPtr glyph = page->glyphs[i];
+
+		if (!glyph)
+			continue;
+
+		free(glyph_get_priv(glyph));
+		glyph_set_priv(glyph, NULL);
+		page->glyphs[i] = NULL;
+		cache->evictions++;
+	}
+}
+
+static struct glyph_page *glyph_cache_evict(struct glyph_cache *cache,
+	unsigned size, uint32_t serial, unsigned *pindex)
+{
+	unsigned n, count, mask, limit;
+
+	count = glyph_size_to_count(size);
+	mask = glyph_count_to_mask(count);
+
+	/* Two sweeps of the clock: the first may only clear references */
+	limit = 2 * cache->num_pages * (GLYPH_CACHE_SIZE / count);
+
+	for (n = 0; n < limit; n++) {
+		struct glyph_page *page = &cache->page[cache->hand_page];
+		unsigned index = cache->hand & mask;
+
+		cache->hand = index + count;
+		if (cache->hand >= GLYPH_CACHE_SIZE) {
+			cache->hand = 0;
+			if (++cache->hand_page >= cache->num_pages)
+				cache->hand_page = 0;
+		}
+
+		if (glyph_block_busy(page, size, index, serial))
+			continue;
+
+		glyph_block_evict(cache, page, size, index);
+
+		/* Keep the page allocator clear of this block */
+		if (page->count < index + count)
+			page->count = index + count;
+
+		*pindex = index;
+		return page;
+	}
+
+	return NULL;
+}
+
+/*
+ * Upload the queued glyphs to their atlas page.  If this fails, the
+ * page contents for these glyphs are unknown, so drop them.
+ */
+static Bool glyph_cache_flush(ScreenPtr pScreen,
+	struct glyph_cache_priv *cache_priv)
+{
+	struct glyph_cache *cache = cache_priv->upload_cache;
+	unsigned i, n = cache_priv->num_uploads;
+	Bool ret;
+
+	if (!n)
+		return TRUE;
+
+	cache_priv->num_uploads = 0;
+
+	ret = cache->upload(pScreen, cache_priv->upload_page->picture,
+			    cache_priv->uploads, n);
+	if (ret)
+		cache->uploads += n;
+	else
+		for (i = 0; i < n; i++)
+			glyph_cache_remove(pScreen, cache_priv->uploads[i].glyph);
+
+	return ret;
+}
+
+static Bool glyph_cache_queue(ScreenPtr pScreen,
+	struct glyph_cache_priv *cache_priv, struct glyph_cache *cache,
+	struct glyph_page *page, GlyphPtr pGlyph, xPoint pos)
+{
+	struct glyph_upload *up;
+
+	if ((cache_priv->num_uploads && cache_priv->upload_page != page) ||
+	    cache_priv->num_uploads >= GLYPH_UPLOAD_BATCH)
+		if (!glyph_cache_flush(pScreen, cache_priv))
+			return FALSE;
+
+	cache_priv->upload_cache = cache;
+	cache_priv->upload_page = page;
+
+	up = &cache_priv->uploads[cache_priv->num_uploads++];
+	up->glyph = pGlyph;
+	up->picture = GetGlyphPicture(pGlyph, pScreen);
+	up->pos = pos;
+
+	return TRUE;
+}
+
+static struct glyph_priv *__glyph_cache(ScreenPtr pScreen,
+	struct glyph_cache_priv *cache_priv, GlyphPtr pGlyph)
 {
 	struct glyph_cache *cache;
+	struct glyph_page *page;
 	struct glyph_priv *priv;
 	unsigned size, sz, mask, count, index, i;
 
@@ -225,7 +477,7 @@ static struct glyph_priv *__glyph_cache(ScreenPtr pScreen, GlyphPtr pGlyph)
 	if (sz > GLYPH_MAX_SIZE)
 		return NULL;
 
-	cache = glyph_get_cache(pScreen, pGlyph);
+	cache = glyph_get_cache(cache_priv, pScreen, pGlyph);
 	if (!cache)
 		return NULL;
 
@@ -236,64 +488,38 @@ static struct glyph_priv *__glyph_cache(ScreenPtr pScreen, GlyphPtr pGlyph)
 	count = glyph_size_to_count(size);
 	mask = glyph_count_to_mask(count);
 
-	index = (cache->count + count - 1) & mask;
+	/* Use free space in the newest page, adding a page if full */
+	page = &cache->page[cache->num_pages - 1];
+	index = (page->count + count - 1) & mask;
+	if (index >= GLYPH_CACHE_SIZE &&
+	    cache->num_pages < cache->max_pages &&
+	    glyph_cache_add_page(pScreen, cache)) {
+		page = &cache->page[cache->num_pages - 1];
+		index = 0;
+	}
+
 	if (index < GLYPH_CACHE_SIZE) {
-		cache->count = index + count;
-		priv = NULL;
+		page->count = index + count;
 	} else {
-		priv = NULL;
-		for (count = size; count <= GLYPH_MAX_SIZE; count *= 2) {
-			unsigned i = cache->evict & glyph_size_to_mask(count);
-			GlyphPtr evicted = cache->glyphs[i];
-
-			if (!evicted)
-				continue;
-
-			priv = glyph_get_priv(evicted);
-			if (priv->size >= count) {
-				glyph_set_priv(evicted, NULL);
-				cache->glyphs[i] = NULL;
-				index = cache->evict & glyph_size_to_mask(size);
-			} else {
-				priv = NULL;
-			}
-			break;
-		}
-
-		if (!priv) {
-			unsigned s;
-
-			count = glyph_size_to_count(size);
-			mask = glyph_count_to_mask(count);
-
-			index = cache->evict & mask;
-
-			for (s = 0; s < count; s++) {
-				GlyphPtr evicted = cache->glyphs[index + s];
-
-				if (!evicted)
-					continue;
-
-				priv = glyph_get_priv(evicted);
-				glyph_set_priv(evicted, NULL);
-				cache->glyphs[index + s] = NULL;
-			}
-		}
-
-		cache->evict = rand() % GLYPH_CACHE_SIZE;
+		page = glyph_cache_evict(cache, size, cache_priv->serial,
+					 &index);
+		if (!page)
+			return NULL;
 	}
 
-	if (!priv)
-		priv = malloc(sizeof(*priv));
+	priv = malloc(sizeof(*priv));
 	if (!priv)
 		return NULL;
 
 	glyph_set_priv(pGlyph, priv);
-	cache->glyphs[index] = pGlyph;
+	page->glyphs[index] = pGlyph;
 
 	priv->cache = cache;
+	priv->page = page;
+	priv->serial = cache_priv->serial;
 	priv->size = size;
 	priv->index = index;
+	priv->referenced = FALSE;
 	i = index / (GLYPH_RATIO_SIZE * GLYPH_RATIO_SIZE);
 	priv->pos.x = i % (CACHE_PICTURE_SIZE / GLYPH_MAX_SIZE) * GLYPH_MAX_SIZE;
 	priv->pos.y = (i / (CACHE_PICTURE_SIZE / GLYPH_MAX_SIZE)) * GLYPH_MAX_SIZE;
@@ -305,13 +531,23 @@ static struct glyph_priv *__glyph_cache(ScreenPtr pScreen, GlyphPtr pGlyph)
 		index >>= 2;
 	}
 
-	cache->upload(pScreen, cache->picture, pGlyph,
-		      GetGlyphPicture(pGlyph, pScreen),
-		      priv->pos.x, priv->pos.y);
+	if (!glyph_cache_queue(pScreen, cache_priv, cache, page, pGlyph,
+			       priv->pos)) {
+		glyph_cache_remove(pScreen, pGlyph);
+		return NULL;
+	}
 
 	return priv;
 }
 
+static void glyph_cache_hit(struct glyph_cache_priv *cache_priv,
+	struct glyph_priv *priv)
+{
+	priv->serial = cache_priv->serial;
+	priv->referenced = TRUE;
+	priv->cache->hits++;
+}
+
 PicturePtr glyph_cache_only(ScreenPtr pScreen, GlyphPtr pGlyph, xPoint *pos)
 {
 	struct glyph_priv *priv;
@@ -319,7 +555,7 @@ PicturePtr glyph_cache_only(ScreenPtr pScreen, GlyphPtr pGlyph, xPoint *pos)
 	priv = glyph_get_priv(pGlyph);
 	if (priv) {
 		*pos = priv->pos;
-		return priv->cache->picture;
+		return priv->page->picture;
 	}
 
 	return NULL;
@@ -327,16 +563,24 @@ PicturePtr glyph_cache_only(ScreenPtr pScreen, GlyphPtr pGlyph, xPoint *pos)
 
 PicturePtr glyph_cache(ScreenPtr pScreen, GlyphPtr pGlyph, xPoint *pos)
 {
+	struct glyph_cache_priv *cache_priv = glyph_cache_get_priv(pScreen);
 	struct glyph_priv *priv;
 
+	if (!cache_priv)
+		goto uncached;
+
 	priv = glyph_get_priv(pGlyph);
-	if (!priv)
-		priv = __glyph_cache(pScreen, pGlyph);
+	if (priv)
+		glyph_cache_hit(cache_priv, priv);
+	else if ((priv = __glyph_cache(pScreen, cache_priv, pGlyph)) &&
+		 !glyph_cache_flush(pScreen, cache_priv))
+		priv = NULL;
 	if (priv) {
 		*pos = priv->pos;
-		return priv->cache->picture;
+		return priv->page->picture;
 	}
 
+ uncached:
 	pos->x = 0;
 	pos->y = 0;
 
@@ -349,8 +593,9 @@ void glyph_cache_remove(ScreenPtr pScreen, GlyphPtr pGlyph)
 
 	priv = glyph_get_priv(pGlyph);
 	if (priv) {
-		priv->cache->glyphs[priv->index] = NULL;
+		priv->page->glyphs[priv->index] = NULL;
 		glyph_set_priv(pGlyph, NULL);
+		free(priv);
 	}
 }
 
@@ -358,6 +603,15 @@ void glyph_cache_remove(ScreenPtr pScreen, GlyphPtr pGlyph)
 Bool glyph_cache_preload(ScreenPtr pScreen, int nlist, GlyphListPtr list,
 	GlyphPtr *glyphs)
 {
+	struct glyph_cache_priv *cache_priv = glyph_cache_get_priv(pScreen);
+	struct glyph_priv *priv;
+
+	if (!cache_priv)
+		return FALSE;
+
+	/* Glyphs used by this request must not evict each other */
+	cache_priv->serial++;
+
 	while (nlist--) {
 		int n = list->len;
 
@@ -367,13 +621,20 @@ Bool glyph_cache_preload(ScreenPtr pScreen, int nlist, GlyphListPtr list,
 			if (glyph->info.width == 0 || glyph->info.height == 0)
 				continue;
 
-			if (glyph_get_priv(glyph))
+			priv = glyph_get_priv(glyph);
+			if (priv) {
+				glyph_cache_hit(cache_priv, priv);
 				continue;
+			}
 
-			if (!__glyph_cache(pScreen, glyph))
+			if (!__glyph_cache(pScreen, cache_priv, glyph)) {
+				glyph_cache_flush(pScreen, cache_priv);
 				return FALSE;
+			}
 		}
 		list++;
 	}
-	return TRUE;
+
+	/* Upload all new glyphs before they are used */
+	return glyph_cache_flush(pScreen, cache_priv);
 }
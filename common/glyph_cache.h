@@ -1,8 +1,14 @@
 #ifndef GLYPH_CACHE_H
 #define GLYPH_CACHE_H
 
-typedef void (*glyph_upload_t)(ScreenPtr, PicturePtr, GlyphPtr,
-			       PicturePtr, unsigned, unsigned);
+struct glyph_upload {
+	GlyphPtr glyph;
+	PicturePtr picture;
+	xPoint pos;
+};
+
+typedef Bool (*glyph_upload_t)(ScreenPtr, PicturePtr,
+			       const struct glyph_upload *, unsigned);
 
 Bool glyph_cache_init(ScreenPtr pScreen, glyph_upload_t,
 	const unsigned *formats, size_t num_formats, unsigned usage_hint);
@@ -29,7 +29,6 @@
 #include "compat-api.h"
 
 #include "cpu_access.h"
-#include "fbutil.h"
 #include "gal_extension.h"
 #include "mark.h"
 #include "pixmaputil.h"
@@ -173,6 +172,15 @@ static void etnaviv_free_pixmap(PixmapPtr pixmap)
 
 		etnaviv = etnaviv_get_screen_priv(pixmap->drawable.pScreen);
 
+		if (vPix->tile_pattern) {
+			pixmap->drawable.pScreen->DestroyPixmap(vPix->tile_pattern);
+			vPix->tile_pattern = NULL;
+		}
+		if (vPix->reflect_pattern) {
+			pixmap->drawable.pScreen->DestroyPixmap(vPix->reflect_pattern);
+			vPix->reflect_pattern = NULL;
+		}
+
 		/*
 		 * Put the pixmap - if it's on one of the batch or fence
 		 * lists, they will hold a refcount, which will be dropped
@@ -186,15 +194,17 @@ static void etnaviv_free_pixmap(PixmapPtr pixmap)
 /* Determine whether this GC and target Drawable can be accelerated */
 static Bool etnaviv_GC_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 {
-	if (!etnaviv_drawable(pDrawable))
-		return FALSE;
-
-	/* Must be full-planes */
-	return !pGC || fb_full_planemask(pDrawable, pGC->planemask);
+	/*
+	 * Partial planemasks are handled by the accelerated operations
+	 * using the ROP and brush, or by falling back themselves.
+	 */
+	return etnaviv_drawable(pDrawable) != NULL;
 }
 
 static Bool etnaviv_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 {
+	struct etnaviv_pixmap *vTile;
+
 	switch (pGC->fillStyle) {
 	case FillSolid:
 		return TRUE;
@@ -209,6 +219,11 @@ static Bool etnaviv_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 		    pGC->tile.pixmap->drawable.height == 1)
 			return TRUE;
 
+		/* Likewise if every pixel in the tile is the same colour */
+		vTile = etnaviv_get_pixmap_priv(pGC->tile.pixmap);
+		if (etnaviv_tile_analysed(vTile) && vTile->tile_flags & TILE_SOLID)
+			return TRUE;
+
 		/* In theory, we could do !tileIsPixel as well, which means
 		 * copying the tile (possibly) multiple times to the drawable.
 		 * This is something we should do, especially if the size of
@@ -222,6 +237,28 @@ static Bool etnaviv_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 	}
 }
 
+/* As above, but record why we are about to fall back */
+static Bool etnaviv_GCfill_check(struct etnaviv *etnaviv, GCPtr pGC,
+	DrawablePtr pDrawable)
+{
+	return etnaviv_GCfill_can_accel(pGC, pDrawable) ||
+	       etnaviv_fallback(etnaviv, FB_GC);
+}
+
+/*
+ * Start collecting the spans generated by the mi code for a polygon,
+ * arc or wide line, so they can be drawn in one go.
+ */
+static Bool etnaviv_span_start(struct etnaviv_span_acc *acc,
+	DrawablePtr pDrawable, GCPtr pGC)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	return !etnaviv->force_fallback &&
+	       etnaviv_GCfill_can_accel(pGC, pDrawable) &&
+	       etnaviv_accel_span_start(acc, pDrawable, pGC);
+}
+
 
 static void
 etnaviv_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n, DDXPointPtr ppt,
@@ -229,12 +266,16 @@ etnaviv_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n, DDXPointPtr ppt,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	assert(etnaviv_GC_can_accel(pGC, pDrawable));
 
 	if (etnaviv->force_fallback ||
-	    !etnaviv_GCfill_can_accel(pGC, pDrawable) ||
+	    !etnaviv_GCfill_check(etnaviv, pGC, pDrawable) ||
 	    !etnaviv_accel_FillSpans(pDrawable, pGC, n, ppt, pwidth, fSorted))
-		unaccel_FillSpans(pDrawable, pGC, n, ppt, pwidth, fSorted);
+		etnaviv_fallback_run(etnaviv, FB_OP_FILL_SPANS,
+			unaccel_FillSpans(pDrawable, pGC, n, ppt, pwidth,
+					  fSorted));
 }
 
 static void
@@ -243,13 +284,16 @@ etnaviv_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	assert(etnaviv_GC_can_accel(pGC, pDrawable));
 
 	if (etnaviv->force_fallback ||
 	    !etnaviv_accel_PutImage(pDrawable, pGC, depth, x, y, w, h, leftPad,
 				    format, bits))
-		unaccel_PutImage(pDrawable, pGC, depth, x, y, w, h, leftPad,
-					 format, bits);
+		etnaviv_fallback_run(etnaviv, FB_OP_PUT_IMAGE,
+			unaccel_PutImage(pDrawable, pGC, depth, x, y, w, h,
+					 leftPad, format, bits));
 }
 
 static RegionPtr
@@ -258,11 +302,18 @@ etnaviv_CopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	assert(etnaviv_GC_can_accel(pGC, pDst));
 
-	if (etnaviv->force_fallback)
-		return unaccel_CopyArea(pSrc, pDst, pGC, srcx, srcy, w, h,
-					dstx, dsty);
+	if (etnaviv->force_fallback) {
+		RegionPtr ret;
+
+		etnaviv_fallback_run(etnaviv, FB_OP_COPY_AREA,
+			ret = unaccel_CopyArea(pSrc, pDst, pGC, srcx, srcy,
+					       w, h, dstx, dsty));
+		return ret;
+	}
 
 	return miDoCopy(pSrc, pDst, pGC, srcx, srcy, w, h, dstx, dsty,
 			etnaviv_accel_CopyNtoN, 0, NULL);
@@ -274,12 +325,15 @@ etnaviv_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	assert(etnaviv_GC_can_accel(pGC, pDrawable));
 
 	if (etnaviv->force_fallback ||
-	    !etnaviv_GCfill_can_accel(pGC, pDrawable) ||
+	    !etnaviv_GCfill_check(etnaviv, pGC, pDrawable) ||
 	    !etnaviv_accel_PolyPoint(pDrawable, pGC, mode, npt, ppt))
-		unaccel_PolyPoint(pDrawable, pGC, mode, npt, ppt);
+		etnaviv_fallback_run(etnaviv, FB_OP_POLY_POINT,
+			unaccel_PolyPoint(pDrawable, pGC, mode, npt, ppt));
 }
 
 static void
@@ -287,18 +341,63 @@ etnaviv_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 	DDXPointPtr ppt)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_span_acc acc;
+
+	etnaviv->fallback.reason = FB_UNKNOWN;
 
 	assert(etnaviv_GC_can_accel(pGC, pDrawable));
 
-	if (etnaviv->force_fallback ||
-	    pGC->lineWidth != 0 || pGC->lineStyle != LineSolid ||
-	    pGC->fillStyle != FillSolid ||
-	    !etnaviv_accel_PolyLines(pDrawable, pGC, mode, npt, ppt))
-		unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+	if (!etnaviv->force_fallback && pGC->lineStyle == LineSolid &&
+	    pGC->fillStyle == FillSolid) {
+		if (pGC->lineWidth == 0) {
+			if (etnaviv_accel_PolyLines(pDrawable, pGC, mode, npt,
+						    ppt))
+				return;
+		} else if (etnaviv_span_start(&acc, pDrawable, pGC)) {
+			miWideLine(pDrawable, pGC, mode, npt, ppt);
+			etnaviv_accel_span_end(&acc);
+			return;
+		}
+	} else {
+		etnaviv_fallback(etnaviv, FB_GC);
+	}
+
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_LINES,
+		unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt));
 }
 
 static void
 etnaviv_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSeg)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_span_acc acc;
+
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (!etnaviv->force_fallback && pGC->lineStyle == LineSolid &&
+	    pGC->fillStyle == FillSolid) {
+		if (pGC->lineWidth == 0) {
+			if (etnaviv_accel_PolySegment(pDrawable, pGC, nseg,
+						      pSeg))
+				return;
+		} else if (etnaviv_span_start(&acc, pDrawable, pGC)) {
+			miPolySegment(pDrawable, pGC, nseg, pSeg);
+			etnaviv_accel_span_end(&acc);
+			return;
+		}
+	} else {
+		etnaviv_fallback(etnaviv, FB_GC);
+	}
+
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_SEGMENT,
+		unaccel_PolySegment(pDrawable, pGC, nseg, pSeg));
+}
+
+static void
+etnaviv_PolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int nrect,
+	xRectangle *prect)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 
@@ -307,8 +406,53 @@ etnaviv_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSeg)
 	if (etnaviv->force_fallback ||
 	    pGC->lineWidth != 0 || pGC->lineStyle != LineSolid ||
 	    pGC->fillStyle != FillSolid ||
-	    !etnaviv_accel_PolySegment(pDrawable, pGC, nseg, pSeg))
-		unaccel_PolySegment(pDrawable, pGC, nseg, pSeg);
+	    !etnaviv_accel_PolyRectangle(pDrawable, pGC, nrect, prect))
+		miPolyRectangle(pDrawable, pGC, nrect, prect);
+}
+
+static void
+etnaviv_PolyArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+	struct etnaviv_span_acc acc;
+	Bool spans;
+
+	/*
+	 * miPolyArc draws the odd dashes of a LineDoubleDash arc by
+	 * temporarily switching the GC foreground to the background
+	 * pixel, which the accumulated spans would not see.
+	 */
+	spans = pGC->lineStyle != LineDoubleDash &&
+		etnaviv_span_start(&acc, pDrawable, pGC);
+
+	miPolyArc(pDrawable, pGC, narcs, parcs);
+
+	if (spans)
+		etnaviv_accel_span_end(&acc);
+}
+
+static void
+etnaviv_FillPolygon(DrawablePtr pDrawable, GCPtr pGC, int shape, int mode,
+	int count, DDXPointPtr ppt)
+{
+	struct etnaviv_span_acc acc;
+	Bool spans = etnaviv_span_start(&acc, pDrawable, pGC);
+
+	miFillPolygon(pDrawable, pGC, shape, mode, count, ppt);
+
+	if (spans)
+		etnaviv_accel_span_end(&acc);
+}
+
+static void
+etnaviv_PolyFillArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+	struct etnaviv_span_acc acc;
+	Bool spans = etnaviv_span_start(&acc, pDrawable, pGC);
+
+	miPolyFillArc(pDrawable, pGC, narcs, parcs);
+
+	if (spans)
+		etnaviv_accel_span_end(&acc);
 }
 
 static void
@@ -318,6 +462,8 @@ etnaviv_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 	PixmapPtr pPix = drawable_pixmap(pDrawable);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	if (etnaviv->force_fallback ||
 	    (pPix->drawable.width == 1 && pPix->drawable.height == 1))
 		goto fallback;
@@ -330,58 +476,326 @@ etnaviv_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
 	} else if (pGC->fillStyle == FillTiled) {
 		if (etnaviv_accel_PolyFillRectTiled(pDrawable, pGC, nrect, prect))
 			return;
+	} else {
+		etnaviv_fallback(etnaviv, FB_GC);
 	}
 
  fallback:
-	unaccel_PolyFillRect(pDrawable, pGC, nrect, prect);
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_FILL_RECT,
+		unaccel_PolyFillRect(pDrawable, pGC, nrect, prect));
+}
+
+static void
+etnaviv_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci))
+		etnaviv_fallback_run(etnaviv, FB_OP_IMAGE_GLYPH,
+			unaccel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph,
+					      ppci, pglyphBase));
+}
+
+static void
+etnaviv_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback || pGC->fillStyle != FillSolid ||
+	    !etnaviv_accel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci))
+		etnaviv_fallback_run(etnaviv, FB_OP_POLY_GLYPH,
+			unaccel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph,
+					     ppci, pglyphBase));
+}
+
+/*
+ * Operations which are always performed by the CPU, whichever GC ops
+ * table is in use.
+ */
+static void etnaviv_GC_fallback(struct etnaviv *etnaviv, GCPtr pGC,
+	DrawablePtr pDrawable)
+{
+	etnaviv_fallback(etnaviv, etnaviv_GC_can_accel(pGC, pDrawable) ?
+			 FB_NO_ACCEL : FB_GC);
+}
+
+static void
+etnaviv_SetSpans(DrawablePtr pDrawable, GCPtr pGC, char *psrc,
+	DDXPointPtr ppt, int *pwidth, int nspans, int fSorted)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_GC_fallback(etnaviv, pGC, pDrawable);
+	etnaviv_fallback_run(etnaviv, FB_OP_SET_SPANS,
+		unaccel_SetSpans(pDrawable, pGC, psrc, ppt, pwidth, nspans,
+				 fSorted));
+}
+
+static RegionPtr
+etnaviv_CopyPlane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	int srcx, int srcy, int w, int h, int dstx, int dsty,
+	unsigned long bitPlane)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
+	RegionPtr ret;
+
+	etnaviv_GC_fallback(etnaviv, pGC, pDst);
+	etnaviv_fallback_run(etnaviv, FB_OP_COPY_PLANE,
+		ret = unaccel_CopyPlane(pSrc, pDst, pGC, srcx, srcy, w, h,
+					dstx, dsty, bitPlane));
+	return ret;
+}
+
+static void
+etnaviv_PushPixels(GCPtr pGC, PixmapPtr pBitmap, DrawablePtr pDrawable,
+	int w, int h, int x, int y)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_GC_fallback(etnaviv, pGC, pDrawable);
+	etnaviv_fallback_run(etnaviv, FB_OP_PUSH_PIXELS,
+		unaccel_PushPixels(pGC, pBitmap, pDrawable, w, h, x, y));
 }
 
 static GCOps etnaviv_GCOps = {
 	etnaviv_FillSpans,
-	unaccel_SetSpans,
+	etnaviv_SetSpans,
 	etnaviv_PutImage,
 	etnaviv_CopyArea,
-	unaccel_CopyPlane,
+	etnaviv_CopyPlane,
 	etnaviv_PolyPoint,
 	etnaviv_PolyLines,
 	etnaviv_PolySegment,
-	miPolyRectangle,
-	miPolyArc,
-	miFillPolygon,
+	etnaviv_PolyRectangle,
+	etnaviv_PolyArc,
+	etnaviv_FillPolygon,
 	etnaviv_PolyFillRect,
-	miPolyFillArc,
+	etnaviv_PolyFillArc,
 	miPolyText8,
 	miPolyText16,
 	miImageText8,
 	miImageText16,
-	unaccel_ImageGlyphBlt,
-	unaccel_PolyGlyphBlt,
-	unaccel_PushPixels
+	etnaviv_ImageGlyphBlt,
+	etnaviv_PolyGlyphBlt,
+	etnaviv_PushPixels
 };
 
+/*
+ * The GC ops used when ValidateGC decides the GC can not be
+ * accelerated.  These account for the fallback before passing the
+ * call on to fb.
+ */
+static void
+etnaviv_fb_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n, DDXPointPtr ppt,
+	int *pwidth, int fSorted)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_FILL_SPANS,
+		unaccel_FillSpans(pDrawable, pGC, n, ppt, pwidth, fSorted));
+}
+
+static void
+etnaviv_fb_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
+	int w, int h, int leftPad, int format, char *bits)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_PUT_IMAGE,
+		unaccel_PutImage(pDrawable, pGC, depth, x, y, w, h, leftPad,
+				 format, bits));
+}
+
+static RegionPtr
+etnaviv_fb_CopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	int srcx, int srcy, int w, int h, int dstx, int dsty)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
+	RegionPtr ret;
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_COPY_AREA,
+		ret = unaccel_CopyArea(pSrc, pDst, pGC, srcx, srcy, w, h,
+				       dstx, dsty));
+	return ret;
+}
+
+static void
+etnaviv_fb_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
+	DDXPointPtr ppt)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_POINT,
+		unaccel_PolyPoint(pDrawable, pGC, mode, npt, ppt));
+}
+
+static void
+etnaviv_fb_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
+	DDXPointPtr ppt)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_LINES,
+		unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt));
+}
+
+static void
+etnaviv_fb_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_SEGMENT,
+		unaccel_PolySegment(pDrawable, pGC, nseg, pSeg));
+}
+
+static void
+etnaviv_fb_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
+	xRectangle *prect)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_FILL_RECT,
+		unaccel_PolyFillRect(pDrawable, pGC, nrect, prect));
+}
+
+static void
+etnaviv_fb_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_IMAGE_GLYPH,
+		unaccel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				      pglyphBase));
+}
+
+static void
+etnaviv_fb_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_fallback(etnaviv, FB_GC);
+	etnaviv_fallback_run(etnaviv, FB_OP_POLY_GLYPH,
+		unaccel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				     pglyphBase));
+}
+
 static GCOps etnaviv_unaccel_GCOps = {
-	unaccel_FillSpans,
-	unaccel_SetSpans,
-	unaccel_PutImage,
-	unaccel_CopyArea,
-	unaccel_CopyPlane,
-	unaccel_PolyPoint,
-	unaccel_PolyLines,
-	unaccel_PolySegment,
+	etnaviv_fb_FillSpans,
+	etnaviv_SetSpans,
+	etnaviv_fb_PutImage,
+	etnaviv_fb_CopyArea,
+	etnaviv_CopyPlane,
+	etnaviv_fb_PolyPoint,
+	etnaviv_fb_PolyLines,
+	etnaviv_fb_PolySegment,
 	miPolyRectangle,
 	miPolyArc,
 	miFillPolygon,
-	unaccel_PolyFillRect,
+	etnaviv_fb_PolyFillRect,
 	miPolyFillArc,
 	miPolyText8,
 	miPolyText16,
 	miImageText8,
 	miImageText16,
-	unaccel_ImageGlyphBlt,
-	unaccel_PolyGlyphBlt,
-	unaccel_PushPixels
+	etnaviv_fb_ImageGlyphBlt,
+	etnaviv_fb_PolyGlyphBlt,
+	etnaviv_PushPixels
 };
 
+/*
+ * Analyse a tile: find its first pixel, and whether it is a single
+ * colour, so that fills do not need to read it back from the GPU.
+ */
+static void etnaviv_analyse_tile(struct etnaviv_pixmap *vTile,
+	PixmapPtr pTile)
+{
+	const uint8_t *row = pTile->devPrivate.ptr;
+	unsigned int x, y, w, h, bpp = pTile->drawable.bitsPerPixel;
+	uint32_t first, pixel = 0;
+	Bool solid = TRUE;
+
+	vTile->tile_flags = 0;
+
+	if (bpp != 8 && bpp != 16 && bpp != 32)
+		return;
+
+	w = pTile->drawable.width;
+	h = pTile->drawable.height;
+
+	first = bpp == 32 ? *(const uint32_t *)row :
+		bpp == 16 ? *(const uint16_t *)row : *row;
+
+	for (y = 0; y < h && solid; y++, row += pTile->devKind) {
+		for (x = 0; x < w; x++) {
+			if (bpp == 32)
+				pixel = ((const uint32_t *)row)[x];
+			else if (bpp == 16)
+				pixel = ((const uint16_t *)row)[x];
+			else
+				pixel = row[x];
+			if (pixel != first) {
+				solid = FALSE;
+				break;
+			}
+		}
+	}
+
+	vTile->tile_pixel = first;
+	vTile->tile_flags = TILE_ANALYSED | (solid ? TILE_SOLID : 0);
+}
+
+/*
+ * Pad and analyse a tile, unless it has not been written since we
+ * last did so.
+ */
+static void etnaviv_validate_tile(PixmapPtr pTile, int bpp)
+{
+	struct etnaviv_pixmap *vTile = etnaviv_get_pixmap_priv(pTile);
+	Bool pad;
+	int access;
+
+	if (etnaviv_tile_analysed(vTile))
+		return;
+
+	pad = FbEvenTile(pTile->drawable.width * bpp);
+	if (!pad && !vTile)
+		return;
+
+	access = pad ? CPU_ACCESS_RW : CPU_ACCESS_RO;
+
+	prepare_cpu_drawable(&pTile->drawable, access);
+	if (pad)
+		fbPadPixmap(pTile);
+	if (vTile)
+		etnaviv_analyse_tile(vTile, pTile);
+	finish_cpu_drawable(&pTile->drawable, access);
+
+	if (vTile)
+		vTile->tile_serial = vTile->serial;
+}
+
 static void
 etnaviv_ValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable)
 {
@@ -414,13 +828,9 @@ etnaviv_ValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable)
 	}
 #endif
 	if (changes & GCTile) {
-		if (!pGC->tileIsPixel &&
-		    FbEvenTile(pGC->tile.pixmap->drawable.width *
-			       pDrawable->bitsPerPixel)) {
-			prepare_cpu_drawable(&pGC->tile.pixmap->drawable, CPU_ACCESS_RW);
-			fbPadPixmap(pGC->tile.pixmap);
-			finish_cpu_drawable(&pGC->tile.pixmap->drawable, CPU_ACCESS_RW);
-		}
+		if (!pGC->tileIsPixel)
+			etnaviv_validate_tile(pGC->tile.pixmap,
+					      pDrawable->bitsPerPixel);
 		/* mask out gctile changes now that we've done the work */
 		changes &= ~GCTile;
 	}
@@ -495,10 +905,14 @@ etnaviv_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	if (etnaviv->force_fallback ||
 	    !etnaviv_accel_GetImage(pDrawable, x, y, w, h, format, planeMask,
 				    d))
-		unaccel_GetImage(pDrawable, x, y, w, h, format, planeMask, d);
+		etnaviv_fallback_run(etnaviv, FB_OP_GET_IMAGE,
+			unaccel_GetImage(pDrawable, x, y, w, h, format,
+					 planeMask, d));
 }
 
 static void
@@ -794,6 +1208,8 @@ static void etnaviv_BlockHandler(BLOCKHANDLER_ARGS_DECL)
 
 	mark_flush();
 
+	etnaviv_fallback_update(pScreen);
+
 	pScreen->BlockHandler = etnaviv->BlockHandler;
 	pScreen->BlockHandler(BLOCKHANDLER_ARGS);
 	etnaviv->BlockHandler = pScreen->BlockHandler;
@@ -957,6 +1373,10 @@ static Bool etnaviv_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 
 	etnaviv_render_screen_init(pScreen);
 
+	if (!etnaviv->force_fallback && !etnaviv_accel_core_glyph_init(pScreen))
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "core glyph cache initialisation failed\n");
+
 	return TRUE;
 
 fail_accel:
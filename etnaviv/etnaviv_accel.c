@@ -14,6 +14,7 @@
 #endif
 
 #include <errno.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #ifdef HAVE_DIX_CONFIG_H
@@ -21,9 +22,11 @@
 #endif
 #include "fb.h"
 #include "gcstruct.h"
+#include "miline.h"
 #include "xf86.h"
 
 #include "boxutil.h"
+#include "core_glyph_cache.h"
 #include "pixmaputil.h"
 #include "prefetch.h"
 #include "unaccel.h"
@@ -40,13 +43,13 @@
 #include <etnaviv/state_2d.xml.h>
 #include "etnaviv_compat.h"
 
-void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
-	struct etnaviv_pixmap *vPix)
+/* Wait for the GPU to finish with the objects attached to this fence */
+void etnaviv_fence_wait(struct etnaviv *etnaviv, struct etnaviv_fence *f)
 {
 	uint32_t id;
 	int ret;
 
-	switch (vPix->fence.state) {
+	switch (f->state) {
 	case B_NONE:
 		return;
 
@@ -59,7 +62,7 @@ void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
 		 * The pixmap is part of a batch which has been submitted,
 		 * so we must wait for the batch to complete.
 		 */
-		id = vPix->fence.id;
+		id = f->id;
 
 		ret = viv_fence_finish(etnaviv->conn, id, VIV_WAIT_INDEFINITE);
 		if (ret != VIV_STATUS_OK)
@@ -70,7 +73,13 @@ void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
 	}
 }
 
-static void etnaviv_batch_add(struct etnaviv *etnaviv,
+void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	etnaviv_fence_wait(etnaviv, &vPix->fence);
+}
+
+void etnaviv_batch_add(struct etnaviv *etnaviv,
 	struct etnaviv_pixmap *vPix)
 {
 	if (etnaviv_fence_add(&etnaviv->fence_head, &vPix->fence))
@@ -109,18 +118,144 @@ static void etnaviv_blit_clipped(struct etnaviv *etnaviv,
 		etnaviv_de_op(etnaviv, op, boxes, n);
 }
 
+/*
+ * A streaming box buffer: boxes are added one at a time, and submitted
+ * to the GPU as the buffer fills.  The batch is only started when the
+ * first box is added.
+ */
+struct etnaviv_box_acc {
+	struct etnaviv *etnaviv;
+	const struct etnaviv_de_op *op;
+	Bool started;
+	Bool two_pass;
+	unsigned int n;
+	struct etnaviv_de_op op2;
+	BoxRec boxes[VIVANTE_MAX_2D_RECTS];
+};
+
+/*
+ * A second pass over the same boxes, with a different ROP and brush.
+ * This is used for fills through a planemask which can not be done
+ * in one pass; the two passes must give the same result when boxes
+ * overlap, irrespective of the order in which they are drawn.
+ */
+struct etnaviv_fill_pass {
+	uint8_t rop;
+	uint32_t colour;
+};
+
+static void etnaviv_box_acc_init(struct etnaviv_box_acc *acc,
+	struct etnaviv *etnaviv, const struct etnaviv_de_op *op,
+	const struct etnaviv_fill_pass *pass2)
+{
+	acc->etnaviv = etnaviv;
+	acc->op = op;
+	acc->started = FALSE;
+	acc->two_pass = pass2 != NULL;
+	acc->n = 0;
+
+	if (pass2) {
+		acc->op2 = *op;
+		acc->op2.rop = pass2->rop;
+		acc->op2.fg_colour = pass2->colour;
+	}
+}
+
+static void etnaviv_box_acc_flush(struct etnaviv_box_acc *acc)
+{
+	if (!acc->started) {
+		etnaviv_batch_start(acc->etnaviv, acc->op);
+		acc->started = TRUE;
+	}
+	etnaviv_de_op(acc->etnaviv, acc->op, acc->boxes, acc->n);
+
+	if (acc->two_pass) {
+		etnaviv_de_end(acc->etnaviv);
+		etnaviv_batch_start(acc->etnaviv, &acc->op2);
+		etnaviv_de_op(acc->etnaviv, &acc->op2, acc->boxes, acc->n);
+		etnaviv_de_end(acc->etnaviv);
+		acc->started = FALSE;
+	}
+
+	acc->n = 0;
+}
+
+static void etnaviv_box_acc_add(struct etnaviv_box_acc *acc,
+	int x1, int y1, int x2, int y2)
+{
+	BoxRec *box = &acc->boxes[acc->n];
+
+	box->x1 = x1;
+	box->y1 = y1;
+	box->x2 = x2;
+	box->y2 = y2;
+
+	if (++acc->n >= VIVANTE_MAX_2D_RECTS)
+		etnaviv_box_acc_flush(acc);
+}
+
+static void etnaviv_box_acc_end(struct etnaviv_box_acc *acc)
+{
+	if (acc->n)
+		etnaviv_box_acc_flush(acc);
+	if (acc->started) {
+		etnaviv_de_end(acc->etnaviv);
+		acc->started = FALSE;
+	}
+}
+
+/*
+ * Clip a box against a region, only walking the clip boxes in the
+ * bands which overlap it.
+ */
+static void etnaviv_box_acc_add_clipped(struct etnaviv_box_acc *acc,
+	RegionPtr clip, const BoxRec *box)
+{
+	const BoxRec *c, *end;
+	int nclip = RegionNumRects(clip);
+	int x1, y1, x2, y2;
+
+	if (box->x1 >= box->x2 || box->y1 >= box->y2)
+		return;
+
+	c = RegionRects(clip);
+	end = c + nclip;
+
+	if (nclip > 1)
+		c = box_band_search(c, nclip, box->y1);
+
+	for (; c < end && c->y1 < box->y2; c++) {
+		if (c->x2 <= box->x1)
+			continue;
+
+		if (c->x1 >= box->x2) {
+			/* Nothing further in this band can overlap */
+			while (c + 1 < end && c[1].y1 == c->y1)
+				c++;
+			continue;
+		}
+
+		x1 = maxt(box->x1, c->x1);
+		y1 = maxt(box->y1, c->y1);
+		x2 = mint(box->x2, c->x2);
+		y2 = mint(box->y2, c->y2);
+		if (x1 < x2 && y1 < y2)
+			etnaviv_box_acc_add(acc, x1, y1, x2, y2);
+	}
+}
+
 static Bool etnaviv_init_dst_drawable(struct etnaviv *etnaviv,
 	struct etnaviv_de_op *op, DrawablePtr pDrawable)
 {
 	op->dst.pixmap = etnaviv_drawable_offset(pDrawable, &op->dst.offset);
 	if (!op->dst.pixmap)
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_NO_GPU);
 
 	if (!etnaviv_dst_format_valid(etnaviv, op->dst.pixmap->format))
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_FORMAT);
 
 	if (!etnaviv_map_gpu(etnaviv, op->dst.pixmap, GPU_ACCESS_RW))
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_NO_GPU);
 
 	op->dst.bo = op->dst.pixmap->etna_bo;
 	op->dst.pitch = op->dst.pixmap->pitch;
@@ -135,15 +270,15 @@ static Bool etnaviv_init_dstsrc_drawable(struct etnaviv *etnaviv,
 	op->dst.pixmap = etnaviv_drawable_offset(pDst, &op->dst.offset);
 	op->src.pixmap = etnaviv_drawable_offset(pSrc, &op->src.offset);
 	if (!op->dst.pixmap || !op->src.pixmap)
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_NO_GPU);
 
 	if (!etnaviv_src_format_valid(etnaviv, op->src.pixmap->format) ||
 	    !etnaviv_dst_format_valid(etnaviv, op->dst.pixmap->format))
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_FORMAT);
 
 	if (!etnaviv_map_gpu(etnaviv, op->dst.pixmap, GPU_ACCESS_RW) ||
 	    !etnaviv_map_gpu(etnaviv, op->src.pixmap, GPU_ACCESS_RO))
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_NO_GPU);
 
 	op->dst.bo = op->dst.pixmap->etna_bo;
 	op->dst.pitch = op->dst.pixmap->pitch;
@@ -188,6 +323,15 @@ void etnaviv_commit(struct etnaviv *etnaviv, Bool stall)
 	uint32_t fence;
 	int ret;
 
+	etnaviv_de_close(etnaviv);
+
+	/*
+	 * The GPU does not keep 2D state across submissions, runtime
+	 * suspend or reset, so the filter kernel must be emitted again
+	 * in the next batch which uses it.
+	 */
+	etnaviv->filter_kernel = NULL;
+
 	ret = etna_flush(ctx, &fence);
 	if (ret) {
 		etnaviv_error(etnaviv, "etna_flush", ret);
@@ -275,15 +419,10 @@ static const uint8_t etnaviv_fill_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
-static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
+static uint32_t etnaviv_pixel_col(struct etnaviv *etnaviv, unsigned depth,
+	uint32_t pixel)
 {
-	uint32_t pixel, colour;
-
-	if (pGC->fillStyle == FillTiled)
-		pixel = pGC->tileIsPixel ? pGC->tile.pixel :
-			get_first_pixel(&pGC->tile.pixmap->drawable);
-	else
-		pixel = pGC->fgPixel;
+	uint32_t colour;
 
 	/* With PE1.0, this is the pixel value, but PE2.0, it must be ARGB */
 	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20))
@@ -294,7 +433,7 @@ static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
 	 * The aim here is to generate an A8R8G8B8 format colour which
 	 * results in a destination pixel value of 'pixel'.
 	 */
-	switch (pGC->depth) {
+	switch (depth) {
 	case 15: /* A1R5G5B5 */
 		colour = (pixel & 0x8000 ? 0xff000000 : 0) |
 			 scale16((pixel & 0x7c00) >> 10, 5) << 16 |
@@ -316,15 +455,134 @@ static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
 	return colour;
 }
 
-static void etnaviv_init_fill(struct etnaviv *etnaviv,
-	struct etnaviv_de_op *op, GCPtr pGC)
+static uint32_t etnaviv_fg_pixel(GCPtr pGC)
 {
+	PixmapPtr pTile = pGC->tile.pixmap;
+	struct etnaviv_pixmap *vTile;
+
+	if (pGC->fillStyle != FillTiled)
+		return pGC->fgPixel;
+
+	if (pGC->tileIsPixel)
+		return pGC->tile.pixel;
+
+	/* Avoid reading back the tile if we already know */
+	vTile = etnaviv_get_pixmap_priv(pTile);
+	if (etnaviv_tile_analysed(vTile))
+		return vTile->tile_pixel;
+
+	return get_first_pixel(&pTile->drawable);
+}
+
+static Bool etnaviv_full_planes(GCPtr pGC)
+{
+	unsigned long full = FbFullMask(pGC->depth);
+
+	return (pGC->planemask & full) == full;
+}
+
+/* The result of the X11 raster operation 'alu' on each bit */
+static uint32_t etnaviv_alu(int alu, uint32_t src, uint32_t dst)
+{
+	uint32_t res = 0;
+
+	if (alu & 1)
+		res |= src & dst;
+	if (alu & 2)
+		res |= src & ~dst;
+	if (alu & 4)
+		res |= ~src & dst;
+	if (alu & 8)
+		res |= ~src & ~dst;
+
+	return res;
+}
+
+/*
+ * Work out the ROP and brush colour to fill with 'pixel' using 'alu'
+ * through the GC planemask.  Each destination plane ends up cleared,
+ * set, left alone or inverted.  The brush selects between two of
+ * these per plane, so up to two can be done in a single pass.
+ * Otherwise, if no planes are inverted, the fill can be done with an
+ * AND pass followed by an OR pass.  Returns the number of passes, or
+ * zero if the fill can not be done.
+ */
+static unsigned int etnaviv_fill_planes(struct etnaviv *etnaviv, GCPtr pGC,
+	int alu, uint32_t pixel, struct etnaviv_fill_pass *pass)
+{
+	static const uint8_t plane_rop[] = { 0x0, 0xf, 0xa, 0x5 };
+	uint32_t planes[4], mask, res0, res1;
+	unsigned int i, n, sel[2];
+
+	if (etnaviv_full_planes(pGC)) {
+		pass[0].rop = etnaviv_fill_rop[alu];
+		pass[0].colour = etnaviv_pixel_col(etnaviv, pGC->depth, pixel);
+		return 1;
+	}
+
+	mask = pGC->planemask & FbFullMask(pGC->depth);
+	res0 = etnaviv_alu(alu, pixel, 0);
+	res1 = etnaviv_alu(alu, pixel, ~0);
+
+	planes[0] = ~res0 & ~res1 & mask;		/* cleared */
+	planes[1] = res0 & res1 & mask;			/* set */
+	planes[2] = (~res0 & res1 & mask) | ~mask;	/* unchanged */
+	planes[3] = res0 & ~res1 & mask;		/* inverted */
+
+	for (i = n = 0; i < 4; i++) {
+		if (planes[i]) {
+			if (n < 2)
+				sel[n] = i;
+			n++;
+		}
+	}
+
+	if (n <= 2) {
+		if (n == 1)
+			sel[1] = sel[0];
+		pass[0].rop = plane_rop[sel[0]] << 4 | plane_rop[sel[1]];
+		pass[0].colour = etnaviv_pixel_col(etnaviv, pGC->depth,
+						   planes[sel[0]]);
+		return 1;
+	}
+
+	if (planes[3])
+		return 0;
+
+	pass[0].rop = 0xa0;	/* ROP_BRUSH_AND_DST */
+	pass[0].colour = etnaviv_pixel_col(etnaviv, pGC->depth, ~planes[0]);
+	pass[1].rop = 0xfa;	/* ROP_BRUSH_OR_DST */
+	pass[1].colour = etnaviv_pixel_col(etnaviv, pGC->depth, planes[1]);
+	return 2;
+}
+
+/*
+ * Set up a fill with the GC foreground.  If the planemask needs a
+ * second pass, it is returned in pass2, or if pass2 is NULL, the fill
+ * fails.  Returns the number of passes, or zero on failure.
+ */
+static unsigned int etnaviv_init_fill(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, struct etnaviv_fill_pass *pass2, GCPtr pGC)
+{
+	struct etnaviv_fill_pass pass[2];
+	unsigned int passes;
+
+	passes = etnaviv_fill_planes(etnaviv, pGC, pGC->alu,
+				     etnaviv_fg_pixel(pGC), pass);
+	if (passes == 0 || (passes > 1 && !pass2))
+		return etnaviv_fallback(etnaviv, FB_GC);
+
 	op->src = INIT_BLIT_NULL;
 	op->blend_op = NULL;
 	op->src_origin_mode = SRC_ORIGIN_NONE;
-	op->rop = etnaviv_fill_rop[pGC->alu];
+	op->rop = pass[0].rop;
 	op->brush = TRUE;
-	op->fg_colour = etnaviv_fg_col(etnaviv, pGC);
+	op->fg_colour = pass[0].colour;
+
+	if (passes > 1)
+		*pass2 = pass[1];
+
+	return passes;
 }
 
 static const uint8_t etnaviv_copy_rop[] = {
@@ -346,91 +604,304 @@ static const uint8_t etnaviv_copy_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
+/*
+ * Set up the ROP for a copy.  A partial planemask is applied by
+ * loading it into the brush: where the brush bit is set, the copy
+ * ROP is used, otherwise the destination is left alone.
+ */
+static void etnaviv_init_copy_rop(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC)
+{
+	uint32_t mask;
+
+	op->rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
+	op->brush = FALSE;
+
+	if (pGC && !etnaviv_full_planes(pGC)) {
+		mask = pGC->planemask & FbFullMask(pGC->depth);
+		op->rop = (op->rop & 0xf0) | 0x0a;
+		op->brush = TRUE;
+		op->fg_colour = etnaviv_pixel_col(etnaviv, pGC->depth, mask);
+	}
+}
+
+/*
+ * Span accumulation.  The mi polygon, arc and wide line code generates
+ * spans a few at a time, calling FillSpans for each batch.  Rather
+ * than drawing each batch separately, collect the spans for the whole
+ * operation, merging vertically adjacent spans of the same extent into
+ * rectangles, and draw them in one go at the end.
+ */
+#define SPAN_ACC_MERGE_DEPTH	16
+
+static Bool etnaviv_span_acc_add(struct etnaviv_span_acc *acc,
+	DrawablePtr pDrawable, GCPtr pGC, int n, DDXPointPtr ppt, int *pwidth)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	if (acc->pDrawable != pDrawable || acc->pGC != pGC)
+		return FALSE;
+
+	if (acc->n + n > acc->size) {
+		unsigned int size = acc->size ? acc->size : 256;
+		BoxRec *boxes;
+
+		while (size < acc->n + n)
+			size *= 2;
+
+		boxes = realloc(acc->boxes, size * sizeof(*boxes));
+		if (!boxes) {
+			/* Draw what we have so far, and the rest directly */
+			etnaviv_accel_span_end(acc);
+			return FALSE;
+		}
+		acc->boxes = boxes;
+		acc->size = size;
+	}
+
+	for (; n; n--, ppt++, pwidth++) {
+		int x1 = ppt->x, x2 = ppt->x + *pwidth, y = ppt->y;
+		unsigned int i, lim;
+		BoxRec *box;
+
+		if (x1 >= x2)
+			continue;
+
+		/* Look for a rectangle finishing on the previous line */
+		lim = acc->n > SPAN_ACC_MERGE_DEPTH ?
+			acc->n - SPAN_ACC_MERGE_DEPTH : 0;
+		for (i = acc->n; i > lim; i--) {
+			box = &acc->boxes[i - 1];
+			if (box->y2 == y && box->x1 == x1 && box->x2 == x2) {
+				box->y2 = y + 1;
+				goto next;
+			}
+		}
+
+		box_init(&acc->boxes[acc->n++], x1, y, x2 - x1, 1);
+ next:
+		etnaviv->span_stats.spans++;
+	}
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_span_start(struct etnaviv_span_acc *acc,
+	DrawablePtr pDrawable, GCPtr pGC)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_pixmap *vPix = etnaviv_drawable(pDrawable);
+
+	acc->pDrawable = pDrawable;
+	acc->pGC = pGC;
+	acc->boxes = NULL;
+	acc->n = acc->size = 0;
+
+	/* Nested operations add to the outer accumulator */
+	if (etnaviv->span_acc)
+		return etnaviv->span_acc->pDrawable == pDrawable &&
+		       etnaviv->span_acc->pGC == pGC;
+
+	if (!vPix || !etnaviv_dst_format_valid(etnaviv, vPix->format))
+		return FALSE;
+
+	etnaviv->span_acc = acc;
+
+	return TRUE;
+}
+
+/* Hand the accumulated spans back to fb */
+static void etnaviv_span_fallback(struct etnaviv_span_acc *acc)
+{
+	unsigned int i;
+
+	for (i = 0; i < acc->n; i++) {
+		DDXPointRec pt;
+		int w = acc->boxes[i].x2 - acc->boxes[i].x1;
+
+		pt.x = acc->boxes[i].x1;
+		for (pt.y = acc->boxes[i].y1; pt.y < acc->boxes[i].y2; pt.y++)
+			unaccel_FillSpans(acc->pDrawable, acc->pGC, 1, &pt, &w,
+					  FALSE);
+	}
+}
+
+void etnaviv_accel_span_end(struct etnaviv_span_acc *acc)
+{
+	struct etnaviv *etnaviv;
+	struct etnaviv_de_op op;
+	struct etnaviv_box_acc out;
+	struct etnaviv_fill_pass pass2;
+	RegionPtr clip;
+	unsigned int i, passes;
+
+	etnaviv = etnaviv_get_screen_priv(acc->pDrawable->pScreen);
+	if (etnaviv->span_acc != acc)
+		goto done;
+
+	etnaviv->span_acc = NULL;
+
+	clip = fbGetCompositeClip(acc->pGC);
+	if (acc->n == 0 || RegionNumRects(clip) == 0)
+		goto done;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, acc->pDrawable) ||
+	    !(passes = etnaviv_init_fill(etnaviv, &op, &pass2, acc->pGC))) {
+		etnaviv_fallback_run(etnaviv, FB_OP_FILL_SPANS,
+			etnaviv_span_fallback(acc));
+		goto done;
+	}
+
+	op.clip = RegionExtents(clip);
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
+	etnaviv->span_stats.rects += acc->n;
+
+	etnaviv_box_acc_init(&out, etnaviv, &op, passes > 1 ? &pass2 : NULL);
+	for (i = 0; i < acc->n; i++)
+		etnaviv_box_acc_add_clipped(&out, clip, &acc->boxes[i]);
+	etnaviv_box_acc_end(&out);
+
+ done:
+	free(acc->boxes);
+	acc->boxes = NULL;
+	acc->n = acc->size = 0;
+}
+
+/*
+ * Draw rectangles formed from runs of spans with BIT_BLT.  Only one
+ * batch can be open at a time, so finish the batch of lines first.
+ */
+static void etnaviv_fill_span_rects(struct etnaviv_box_acc *lines,
+	const struct etnaviv_de_op *op, const struct etnaviv_fill_pass *pass2,
+	RegionPtr clip, const BoxRec *rects, unsigned int n)
+{
+	struct etnaviv_box_acc acc;
+	unsigned int i;
+
+	etnaviv_box_acc_end(lines);
+
+	etnaviv_box_acc_init(&acc, lines->etnaviv, op, pass2);
+	for (i = 0; i < n; i++)
+		etnaviv_box_acc_add_clipped(&acc, clip, &rects[i]);
+	etnaviv_box_acc_end(&acc);
+}
+
+#define FILL_SPAN_RECTS		64
+
 Bool etnaviv_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	DDXPointPtr ppt, int *pwidth, int fSorted)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
+	struct etnaviv_de_op op, op_blt;
+	struct etnaviv_box_acc acc;
+	struct etnaviv_fill_pass pass2, *p2;
 	RegionPtr clip = fbGetCompositeClip(pGC);
-	int nclip;
-	BoxRec *boxes, *b;
-	size_t sz;
+	const BoxRec *clip_box, *clip_end;
+	BoxRec rects[FILL_SPAN_RECTS];
+	unsigned int passes, nrects = 0;
+	int nclip, i, j;
 
 	assert(pGC->miTranslate);
 
-	if (RegionNumRects(clip) == 0)
+	nclip = RegionNumRects(clip);
+	if (nclip == 0)
+		return TRUE;
+
+	if (etnaviv->span_acc &&
+	    etnaviv_span_acc_add(etnaviv->span_acc, pDrawable, pGC, n, ppt,
+				 pwidth))
 		return TRUE;
 
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	passes = etnaviv_init_fill(etnaviv, &op, &pass2, pGC);
+	if (!passes)
+		return FALSE;
+
+	p2 = passes > 1 ? &pass2 : NULL;
+
 	op.clip = RegionExtents(clip);
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
 
-	nclip = RegionNumRects(clip);
-	sz = sizeof(BoxRec) * n * nclip;
+	op_blt = op;
+	op_blt.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 
-	/* If we overflow, fallback.  We could do better here. */
-	if (sz / nclip != sizeof(BoxRec) * n)
-		return FALSE;
+	etnaviv_box_acc_init(&acc, etnaviv, &op, p2);
 
-	boxes = malloc(sz);
-	if (!boxes)
-		return FALSE;
+	clip_box = RegionRects(clip);
+	clip_end = clip_box + nclip;
 
 	prefetch(ppt);
 	prefetch(ppt + 8);
 	prefetch(pwidth);
 	prefetch(pwidth + 8);
 
-	b = boxes;
+	etnaviv->span_stats.spans += n;
 
-	while (n--) {
-		BoxPtr pBox;
-		int nBox, x, y, w;
+	for (i = 0; i < n; i = j) {
+		const BoxRec *c;
+		int x1, x2, y;
+
+		prefetch(ppt + i + 16);
+		prefetch(pwidth + i + 16);
 
-		prefetch(ppt + 16);
-		prefetch(pwidth + 16);
+		y = ppt[i].y;
+		x1 = ppt[i].x;
+		x2 = x1 + pwidth[i];
 
-		nBox = nclip;
-		pBox = RegionRects(clip);
+		/*
+		 * Find the run of following spans on consecutive lines
+		 * with the same extent.  Such a run is a rectangle, which
+		 * is better drawn with one BIT_BLT than as many lines.
+		 */
+		for (j = i + 1; j < n; j++)
+			if (ppt[j].y != y + j - i || ppt[j].x != x1 ||
+			    pwidth[j] != pwidth[i])
+				break;
 
-		y = ppt->y;
-		x = ppt->x;
-		w = *pwidth++;
+		if (x1 >= x2)
+			continue;
 
-		do {
-			if (pBox->y1 <= y && pBox->y2 > y) {
-				int l, r;
-
-				l = x;
-				if (l < pBox->x1)
-					l = pBox->x1;
-				r = x + w;
-				if (r > pBox->x2)
-					r = pBox->x2;
-
-				if (l < r) {
-					b->x1 = l;
-					b->y1 = y;
-					b->x2 = r;
-					b->y2 = y;
-					b++;
-				}
+		if (j - i > 1) {
+			box_init(&rects[nrects++], x1, y, x2 - x1, j - i);
+			etnaviv->span_stats.rects++;
+
+			if (nrects >= FILL_SPAN_RECTS) {
+				etnaviv_fill_span_rects(&acc, &op_blt, p2,
+							clip, rects, nrects);
+				nrects = 0;
 			}
-			pBox++;
-		} while (--nBox);
-		ppt++;
-	}
+			continue;
+		}
 
-	if (b != boxes) {
-		etnaviv_batch_start(etnaviv, &op);
-		etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-		etnaviv_de_end(etnaviv);
+		etnaviv->span_stats.lines++;
+
+		/*
+		 * Only walk the band containing this line: the boxes in
+		 * a band are sorted by x.
+		 */
+		c = nclip > 1 ? box_band_search(clip_box, nclip, y) : clip_box;
+		for (; c < clip_end && c->y1 <= y; c++) {
+			int l, r;
+
+			if (c->x2 <= x1)
+				continue;
+			if (c->x1 >= x2)
+				break;
+
+			l = maxt(x1, (int)c->x1);
+			r = mint(x2, (int)c->x2);
+
+			etnaviv_box_acc_add(&acc, l, y, r, y);
+		}
 	}
 
-	free(boxes);
+	if (nrects)
+		etnaviv_fill_span_rects(&acc, &op_blt, p2, clip, rects, nrects);
+	else
+		etnaviv_box_acc_end(&acc);
 
 	return TRUE;
 }
@@ -527,6 +998,8 @@ void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	if (!nBox)
 		return;
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
 	if (etnaviv->force_fallback)
 		goto fallback;
 
@@ -559,9 +1032,8 @@ void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 
 	op.blend_op = NULL;
 	op.clip = &extent;
-	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+	etnaviv_init_copy_rop(etnaviv, &op, pGC);
 
 	etnaviv_batch_start(etnaviv, &op);
 	etnaviv_blit_clipped(etnaviv, &op, pBox, nBox);
@@ -570,8 +1042,9 @@ void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	return;
 
  fallback:
-	unaccel_CopyNtoN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse,
-		upsidedown, bitPlane, closure);
+	etnaviv_fallback_run(etnaviv, FB_OP_COPY_AREA,
+		unaccel_CopyNtoN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse,
+				 upsidedown, bitPlane, closure));
 }
 
 Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
@@ -587,7 +1060,8 @@ Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	if (!etnaviv_init_fill(etnaviv, &op, NULL, pGC))
+		return FALSE;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 
 	pBox = malloc(npt * sizeof *pBox);
@@ -635,167 +1109,255 @@ Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	return TRUE;
 }
 
-Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
-	int npt, DDXPointPtr ppt)
+/*
+ * Zero-width lines.  The line drawing engine does not allow us to
+ * specify the Bresenham error terms, so we can not guarantee that it
+ * lights the same pixels as mi/fb would.  Instead, we step the lines
+ * ourselves using the same algorithm, bias and per-clip-box start
+ * error terms as fbSegment(), and fill the runs of pixels along the
+ * major axis as rectangles.
+ */
+static void etnaviv_zero_runs(struct etnaviv_box_acc *acc, Bool xmajor,
+	int maj, int min, int sdmaj, int sdmin, int e, int e1, int e2,
+	int len)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
-	RegionPtr clip = fbGetCompositeClip(pGC);
-	const BoxRec *box;
-	int nclip, i;
-	BoxRec *boxes, *b;
-	xSegment seg;
-
-	assert(pGC->miTranslate);
-
-	if (RegionNumRects(clip) == 0)
-		return TRUE;
+	while (len) {
+		int start = maj, n = 0;
+		Bool step;
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
-		return FALSE;
+		do {
+			n++;
+			maj += sdmaj;
+			step = e >= 0;
+			e += step ? e2 : e1;
+		} while (--len && !step);
+
+		if (sdmaj < 0)
+			start -= n - 1;
+
+		if (xmajor)
+			etnaviv_box_acc_add(acc, start, min, start + n, min + 1);
+		else
+			etnaviv_box_acc_add(acc, min, start, min + 1, start + n);
+
+		if (step)
+			min += sdmin;
+	}
+}
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
+static void etnaviv_zero_segment(struct etnaviv_box_acc *acc,
+	RegionPtr clip, unsigned int bias, int x1, int y1, int x2, int y2,
+	Bool draw_last)
+{
+	const BoxRec *box;
+	int adx, ady, signdx, signdy, octant;
+	int e, e1, e2, len, nclip;
+	Bool xmajor;
+
+	CalcLineDeltas(x1, y1, x2, y2, adx, ady, signdx, signdy, 1, 1, octant);
+
+	xmajor = adx > ady;
+	if (xmajor) {
+		e1 = ady << 1;
+		e2 = e1 - (adx << 1);
+		e = e1 - adx;
+		len = adx;
+	} else {
+		e1 = adx << 1;
+		e2 = e1 - (ady << 1);
+		e = e1 - ady;
+		len = ady;
+		SetYMajorOctant(octant);
+	}
 
-	boxes = malloc(sizeof(BoxRec) * npt);
-	if (!boxes)
-		return FALSE;
+	FIXUP_ERROR(e, octant, bias);
 
 	nclip = RegionNumRects(clip);
 	for (box = RegionRects(clip); nclip; nclip--, box++) {
-		seg.x1 = ppt[0].x;
-		seg.y1 = ppt[0].y;
-
-		for (b = boxes, i = 1; i < npt; i++) {
-			seg.x2 = ppt[i].x;
-			seg.y2 = ppt[i].y;
+		int nx1 = x1, ny1 = y1, nx2 = x2, ny2 = y2;
+		int clip1 = 0, clip2 = 0, oc1 = 0, oc2 = 0;
+		int ne = e, nlen = len;
 
-			if (mode == CoordModePrevious) {
-				seg.x2 += seg.x1;
-				seg.y2 += seg.y1;
-			}
-
-			if (seg.x1 != seg.x2 && seg.y1 != seg.y2) {
-				free(boxes);
-				return FALSE;
-			}
+		OUTCODES(oc1, x1, y1, box);
+		OUTCODES(oc2, x2, y2, box);
+		if (oc1 & oc2)
+			continue;
 
-			/* We have to add the drawable position into the offset */
-			seg.x1 += pDrawable->x;
-			seg.x2 += pDrawable->x;
-			seg.y1 += pDrawable->y;
-			seg.y2 += pDrawable->y;
+		if (oc1 | oc2) {
+			int clipdx, clipdy;
 
-			if (!box_intersect_line_rough(box, &seg))
+			if (miZeroClipLine(box->x1, box->y1,
+					   box->x2 - 1, box->y2 - 1,
+					   &nx1, &ny1, &nx2, &ny2, adx, ady,
+					   &clip1, &clip2, octant, bias,
+					   oc1, oc2) == -1)
 				continue;
 
-			if (i == npt - 1 && pGC->capStyle != CapNotLast) {
-				if (seg.x1 < seg.x2)
-					seg.x2 += 1;
-				else if (seg.x1 > seg.x2)
-					seg.x2 -= 1;
-				if (seg.y1 < seg.y2)
-					seg.y2 += 1;
-				else if (seg.y1 > seg.y2)
-					seg.y2 -= 1;
-			}
-
-			b->x1 = seg.x1;
-			b->y1 = seg.y1;
-			b->x2 = seg.x2;
-			b->y2 = seg.y2;
-			b++;
-
-			seg.x1 = ppt[i].x;
-			seg.y1 = ppt[i].y;
-		}
+			nlen = xmajor ? abs(nx2 - nx1) : abs(ny2 - ny1);
 
-		if (b != boxes) {
-			op.clip = box;
-			etnaviv_batch_start(etnaviv, &op);
-			etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-			etnaviv_de_end(etnaviv);
+			/* Calculate the error term at the clipped start */
+			clipdx = abs(nx1 - x1);
+			clipdy = abs(ny1 - y1);
+			if (xmajor)
+				ne += clipdy * e2 + (clipdx - clipdy) * e1;
+			else
+				ne += clipdx * e2 + (clipdy - clipdx) * e1;
 		}
-	}
 
-	free(boxes);
+		/* If the end point was clipped, it must always be drawn */
+		if (clip2 || draw_last)
+			nlen++;
 
-	return FALSE;
+		if (xmajor)
+			etnaviv_zero_runs(acc, TRUE, nx1, ny1, signdx, signdy,
+					  ne, e1, e2, nlen);
+		else
+			etnaviv_zero_runs(acc, FALSE, ny1, nx1, signdy, signdx,
+					  ne, e1, e2, nlen);
+	}
 }
 
-Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
-	xSegment *pSeg)
+static Bool etnaviv_zero_start(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, struct etnaviv_box_acc *acc,
+	DrawablePtr pDrawable, GCPtr pGC)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
-	RegionPtr clip = fbGetCompositeClip(pGC);
-	const BoxRec *box;
-	int nclip, i;
-	BoxRec *boxes, *b;
-	bool last;
-
-	assert(pGC->miTranslate);
+	struct etnaviv_fill_pass pass2;
+	unsigned int passes;
 
-	if (RegionNumRects(clip) == 0)
-		return TRUE;
+	if (!etnaviv_init_dst_drawable(etnaviv, op, pDrawable))
+		return FALSE;
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+	passes = etnaviv_init_fill(etnaviv, op, &pass2, pGC);
+	if (!passes)
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
+	op->clip = RegionExtents(fbGetCompositeClip(pGC));
+	op->cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 
-	last = pGC->capStyle != CapNotLast;
+	etnaviv_box_acc_init(acc, etnaviv, op, passes > 1 ? &pass2 : NULL);
+
+	return TRUE;
+}
 
-	boxes = malloc(sizeof(BoxRec) * nseg * (1 + last));
-	if (!boxes)
+static void etnaviv_zero_polyline(struct etnaviv_box_acc *acc,
+	DrawablePtr pDrawable, GCPtr pGC, int mode, int npt, DDXPointPtr ppt)
+{
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	unsigned int bias = miGetZeroLineBias(pDrawable->pScreen);
+	int xorg = pDrawable->x, yorg = pDrawable->y;
+	int x1, y1, x2, y2, i;
+	Bool last;
+
+	x1 = ppt[0].x;
+	y1 = ppt[0].y;
+
+	for (i = 1; i < npt; i++) {
+		x2 = ppt[i].x;
+		y2 = ppt[i].y;
+		if (mode == CoordModePrevious) {
+			x2 += x1;
+			y2 += y1;
+		}
+
+		/*
+		 * Like mi, don't light the final point twice for closed
+		 * lines - it matters for non-idempotent functions.
+		 */
+		last = i == npt - 1 && pGC->capStyle != CapNotLast &&
+		       (x2 != ppt[0].x || y2 != ppt[0].y || npt == 2);
+
+		etnaviv_zero_segment(acc, clip, bias, x1 + xorg, y1 + yorg,
+				     x2 + xorg, y2 + yorg, last);
+
+		x1 = x2;
+		y1 = y2;
+	}
+}
+
+Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_de_op op;
+	struct etnaviv_box_acc acc;
+
+	assert(pGC->miTranslate);
+
+	if (RegionNumRects(fbGetCompositeClip(pGC)) == 0 || npt < 2)
+		return TRUE;
+
+	if (!etnaviv_zero_start(etnaviv, &op, &acc, pDrawable, pGC))
 		return FALSE;
 
-	nclip = RegionNumRects(clip);
-	for (box = RegionRects(clip); nclip; nclip--, box++) {
-		for (b = boxes, i = 0; i < nseg; i++) {
-			xSegment seg = pSeg[i];
+	etnaviv_zero_polyline(&acc, pDrawable, pGC, mode, npt, ppt);
+	etnaviv_box_acc_end(&acc);
 
-			/* We have to add the drawable position into the offset */
-			seg.x1 += pDrawable->x;
-			seg.x2 += pDrawable->x;
-			seg.y1 += pDrawable->y;
-			seg.y2 += pDrawable->y;
+	return TRUE;
+}
 
-			if (!box_intersect_line_rough(box, &seg))
-				continue;
+Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	unsigned int bias = miGetZeroLineBias(pDrawable->pScreen);
+	int xorg = pDrawable->x, yorg = pDrawable->y;
+	struct etnaviv_de_op op;
+	struct etnaviv_box_acc acc;
+	Bool last;
 
-			b->x1 = seg.x1;
-			b->y1 = seg.y1;
-			b->x2 = seg.x2;
-			b->y2 = seg.y2;
-			b++;
-
-			if (last &&
-			    seg.x2 >= box->x1 && seg.x2 < box->x2 &&
-			    seg.y2 >= box->y1 && seg.y2 < box->y2) {
-				/*
-				 * Draw a one pixel long line to light the
-				 * last pixel on the line, but only if the
-				 * point is not off the edge.
-				 */
-				b->x1 = seg.x2;
-				b->y1 = seg.y2;
-				b->x2 = seg.x2 + 1;
-				b->y2 = seg.y2;
-				b++;
-			}
-		}
+	assert(pGC->miTranslate);
 
-		if (b != boxes) {
-			op.clip = box;
-			etnaviv_batch_start(etnaviv, &op);
-			etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-			etnaviv_de_end(etnaviv);
-		}
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	if (!etnaviv_zero_start(etnaviv, &op, &acc, pDrawable, pGC))
+		return FALSE;
+
+	last = pGC->capStyle != CapNotLast;
+
+	for (; nseg; nseg--, pSeg++)
+		etnaviv_zero_segment(&acc, clip, bias,
+				     pSeg->x1 + xorg, pSeg->y1 + yorg,
+				     pSeg->x2 + xorg, pSeg->y2 + yorg, last);
+
+	etnaviv_box_acc_end(&acc);
+
+	return TRUE;
+}
+
+/*
+ * miPolyRectangle() draws zero-width rectangles as a closed polyline
+ * per rectangle; do the same, but in a single batch.
+ */
+Bool etnaviv_accel_PolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int n,
+	xRectangle *prect)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_de_op op;
+	struct etnaviv_box_acc acc;
+
+	assert(pGC->miTranslate);
+
+	if (RegionNumRects(fbGetCompositeClip(pGC)) == 0)
+		return TRUE;
+
+	if (!etnaviv_zero_start(etnaviv, &op, &acc, pDrawable, pGC))
+		return FALSE;
+
+	for (; n; n--, prect++) {
+		DDXPointRec pt[5];
+
+		pt[0].x = pt[3].x = pt[4].x = prect->x;
+		pt[0].y = pt[1].y = pt[4].y = prect->y;
+		pt[1].x = pt[2].x = prect->x + prect->width;
+		pt[2].y = pt[3].y = prect->y + prect->height;
+
+		etnaviv_zero_polyline(&acc, pDrawable, pGC, CoordModeOrigin,
+				      5, pt);
 	}
 
-	free(boxes);
+	etnaviv_box_acc_end(&acc);
 
 	return TRUE;
 }
@@ -805,9 +1367,10 @@ Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 	struct etnaviv_de_op op;
+	struct etnaviv_box_acc acc;
+	struct etnaviv_fill_pass pass2;
 	RegionPtr clip = fbGetCompositeClip(pGC);
-	BoxRec boxes[VIVANTE_MAX_2D_RECTS], *box;
-	int nclip, nb, chunk;
+	unsigned int passes;
 
 	if (RegionNumRects(clip) == 0)
 		return TRUE;
@@ -818,14 +1381,15 @@ Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	prefetch(prect);
 	prefetch(prect + 4);
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	passes = etnaviv_init_fill(etnaviv, &op, &pass2, pGC);
+	if (!passes)
+		return FALSE;
+
 	op.clip = RegionExtents(clip);
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 
-	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_box_acc_init(&acc, etnaviv, &op, passes > 1 ? &pass2 : NULL);
 
-	chunk = VIVANTE_MAX_2D_RECTS;
-	nb = 0;
 	while (n--) {
 		BoxRec full_rect;
 
@@ -838,22 +1402,272 @@ Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 
 		prect++;
 
-		for (box = RegionRects(clip), nclip = RegionNumRects(clip);
-		     nclip; nclip--, box++) {
-			if (__box_intersect(&boxes[nb], &full_rect, box))
-				continue;
+		etnaviv_box_acc_add_clipped(&acc, clip, &full_rect);
+	}
 
-			if (++nb >= chunk) {
-				etnaviv_de_op(etnaviv, &op, boxes, nb);
-				nb = 0;
-			}
-		}
+	etnaviv_box_acc_end(&acc);
+
+	return TRUE;
+}
+
+/*
+ * Small tiles result in many small blits.  Keep a copy of the tile
+ * replicated to at least TILE_PATTERN_SIZE square, which is rebuilt
+ * whenever the tile has been written.
+ */
+#define TILE_PATTERN_SIZE	256
+
+/* Largest source which will be mirrored for a reflected pattern */
+#define REFLECT_PATTERN_MAX	256
+
+static void etnaviv_tile_copy(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, const BoxRec *box)
+{
+	op->clip = box;
+	etnaviv_batch_start(etnaviv, op);
+	etnaviv_de_op(etnaviv, op, box, 1);
+	etnaviv_de_end(etnaviv);
+}
+
+/*
+ * Get the pattern pixmap cached in *ppPat, allocating one large enough
+ * for a whole number of cell_w x cell_h cells if necessary.
+ */
+static struct etnaviv_pixmap *etnaviv_pattern_get(struct etnaviv *etnaviv,
+	PixmapPtr pSrc, PixmapPtr *ppPat, unsigned cell_w, unsigned cell_h)
+{
+	ScreenPtr pScreen = pSrc->drawable.pScreen;
+	struct etnaviv_pixmap *vPat;
+	unsigned pat_w, pat_h;
+	PixmapPtr pPat;
+
+	if (*ppPat)
+		return etnaviv_get_pixmap_priv(*ppPat);
+
+	pat_w = cell_w * ((TILE_PATTERN_SIZE + cell_w - 1) / cell_w);
+	pat_h = cell_h * ((TILE_PATTERN_SIZE + cell_h - 1) / cell_h);
+
+	pPat = pScreen->CreatePixmap(pScreen, pat_w, pat_h,
+				     pSrc->drawable.depth,
+				     CREATE_PIXMAP_USAGE_GPU);
+	if (!pPat)
+		return NULL;
+
+	vPat = etnaviv_get_pixmap_priv(pPat);
+	if (!vPat || !etnaviv_dst_format_valid(etnaviv, vPat->format)) {
+		pScreen->DestroyPixmap(pPat);
+		return NULL;
+	}
+
+	*ppPat = pPat;
+
+	return vPat;
+}
+
+/*
+ * Replicate the cell at the origin of the pattern over the whole
+ * pattern, doubling the replicated area horizontally then vertically.
+ * Each copy reads the result of the previous one, so each must be a
+ * separate batch to ensure the previous copy has been flushed.
+ */
+static void etnaviv_pattern_replicate(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, struct etnaviv_pixmap *vPat,
+	unsigned cell_w, unsigned cell_h)
+{
+	unsigned pat_w = vPat->width;
+	unsigned pat_h = vPat->height;
+	unsigned pos, n;
+	BoxRec box;
+
+	op->src = INIT_BLIT_PIX(vPat, vPat->format, ZERO_OFFSET);
+	op->src_origin_mode = SRC_ORIGIN_RELATIVE;
+	for (pos = cell_w; pos < pat_w; pos += n) {
+		n = min_t(unsigned, pos, pat_w - pos);
+		op->src.offset.x = -pos;
+		box_init(&box, pos, 0, n, cell_h);
+		etnaviv_tile_copy(etnaviv, op, &box);
+	}
+	op->src.offset.x = 0;
+	for (pos = cell_h; pos < pat_h; pos += n) {
+		n = min_t(unsigned, pos, pat_h - pos);
+		op->src.offset.y = -pos;
+		box_init(&box, 0, pos, pat_w, n);
+		etnaviv_tile_copy(etnaviv, op, &box);
+	}
+}
+
+PixmapPtr etnaviv_tile_pattern(struct etnaviv *etnaviv, PixmapPtr pTile)
+{
+	struct etnaviv_pixmap *vTile = etnaviv_get_pixmap_priv(pTile);
+	unsigned tile_w = pTile->drawable.width;
+	unsigned tile_h = pTile->drawable.height;
+	struct etnaviv_pixmap *vPat;
+	struct etnaviv_de_op op;
+	BoxRec box;
+
+	if (!vTile)
+		return NULL;
+
+	if ((tile_w >= TILE_PATTERN_SIZE && tile_h >= TILE_PATTERN_SIZE) ||
+	    vTile->state & ST_DMABUF)
+		return NULL;
+
+	if (vTile->tile_pattern &&
+	    vTile->tile_pattern_serial == vTile->serial)
+		return vTile->tile_pattern;
+
+	vPat = etnaviv_pattern_get(etnaviv, pTile, &vTile->tile_pattern,
+				   tile_w, tile_h);
+	if (!vPat)
+		return NULL;
+
+	if (!etnaviv_map_gpu(etnaviv, vTile, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vPat, GPU_ACCESS_RW))
+		return NULL;
+
+	op.dst = INIT_BLIT_PIX(vPat, vPat->format, ZERO_OFFSET);
+	op.src = INIT_BLIT_PIX(vTile, vTile->format, ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+
+	box_init(&box, 0, 0, tile_w, tile_h);
+	etnaviv_tile_copy(etnaviv, &op, &box);
+
+	etnaviv_pattern_replicate(etnaviv, &op, vPat, tile_w, tile_h);
+
+	vTile->tile_pattern_serial = vTile->serial;
+
+	return vTile->tile_pattern;
+}
+
+/*
+ * RENDER's RepeatReflect repeats the pixmap mirrored in alternate
+ * cells, which gives a period of twice the pixmap size.  Build one
+ * period by copying the pixmap a column at a time and then a row at
+ * a time, and replicate it as for tiles.
+ */
+PixmapPtr etnaviv_reflect_pattern(struct etnaviv *etnaviv, PixmapPtr pPix)
+{
+	struct etnaviv_pixmap *vPix = etnaviv_get_pixmap_priv(pPix);
+	unsigned w = pPix->drawable.width;
+	unsigned h = pPix->drawable.height;
+	struct etnaviv_pixmap *vPat;
+	struct etnaviv_de_op op;
+	BoxRec clip, box;
+	unsigned i;
+
+	if (w > REFLECT_PATTERN_MAX || h > REFLECT_PATTERN_MAX ||
+	    vPix->state & ST_DMABUF)
+		return NULL;
+
+	if (vPix->reflect_pattern &&
+	    vPix->reflect_pattern_serial == vPix->serial)
+		return vPix->reflect_pattern;
+
+	vPat = etnaviv_pattern_get(etnaviv, pPix, &vPix->reflect_pattern,
+				   w * 2, h * 2);
+	if (!vPat)
+		return NULL;
+
+	if (!etnaviv_map_gpu(etnaviv, vPix, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vPat, GPU_ACCESS_RW))
+		return NULL;
+
+	op.dst = INIT_BLIT_PIX(vPat, vPat->format, ZERO_OFFSET);
+	op.src = INIT_BLIT_PIX(vPix, vPix->format, ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+
+	/* The pixmap, followed by its columns in reverse order */
+	box_init(&clip, 0, 0, w * 2, h);
+	op.clip = &clip;
+	etnaviv_batch_start(etnaviv, &op);
+	box_init(&box, 0, 0, w, h);
+	etnaviv_de_op_src_origin(etnaviv, &op, ZERO_OFFSET, &box);
+	for (i = 0; i < w; i++) {
+		xPoint origin = { w - 1 - i, 0 };
+
+		box_init(&box, w + i, 0, 1, h);
+		etnaviv_de_op_src_origin(etnaviv, &op, origin, &box);
 	}
-	if (nb)
-		etnaviv_de_op(etnaviv, &op, boxes, nb);
 	etnaviv_de_end(etnaviv);
 
-	return TRUE;
+	/* The rows just written, in reverse order */
+	op.src = INIT_BLIT_PIX(vPat, vPat->format, ZERO_OFFSET);
+	box_init(&clip, 0, h, w * 2, h);
+	etnaviv_batch_start(etnaviv, &op);
+	for (i = 0; i < h; i++) {
+		xPoint origin = { 0, h - 1 - i };
+
+		box_init(&box, 0, h + i, w * 2, 1);
+		etnaviv_de_op_src_origin(etnaviv, &op, origin, &box);
+	}
+	etnaviv_de_end(etnaviv);
+
+	etnaviv_pattern_replicate(etnaviv, &op, vPat, w * 2, h * 2);
+
+	vPix->reflect_pattern_serial = vPix->serial;
+
+	return vPix->reflect_pattern;
+}
+
+/*
+ * Fill the box from the source tile, whose origin is at tile_off in
+ * destination coordinates.  The batch must already have been started
+ * with a SRC_ORIGIN_NONE operation.
+ */
+void etnaviv_de_op_tiled(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *pBox,
+	int tile_w, int tile_h, xPoint tile_off)
+{
+	xPoint tile_origin;
+	int dst_y, height, tile_y;
+
+	dst_y = pBox->y1;
+	height = pBox->y2 - dst_y;
+	modulus(dst_y - tile_off.y, tile_h, tile_y);
+
+	tile_origin.y = tile_y;
+
+	while (height > 0) {
+		int dst_x, width, tile_x, h;
+
+		dst_x = pBox->x1;
+		width = pBox->x2 - dst_x;
+		modulus(dst_x - tile_off.x, tile_w, tile_x);
+
+		tile_origin.x = tile_x;
+
+		h = tile_h - tile_origin.y;
+		if (h > height)
+			h = height;
+		height -= h;
+
+		while (width > 0) {
+			BoxRec dst;
+			int w;
+
+			w = tile_w - tile_origin.x;
+			if (w > width)
+				w = width;
+			width -= w;
+
+			box_init(&dst, dst_x, dst_y, w, h);
+			etnaviv_de_op_src_origin(etnaviv, op, tile_origin,
+						 &dst);
+
+			dst_x += w;
+			tile_origin.x = 0;
+		}
+		dst_y += h;
+		tile_origin.y = 0;
+	}
 }
 
 Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
@@ -862,18 +1676,27 @@ Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 	struct etnaviv_de_op op;
 	PixmapPtr pTile = pGC->tile.pixmap;
+	PixmapPtr pPat;
 	RegionPtr rects;
 	int nbox;
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable) ||
-	    !etnaviv_init_src_pixmap(etnaviv, &op, pTile))
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	/*
+	 * The replicated pattern has the same period as the tile, so it
+	 * can be used in place of the tile with fewer, larger blits.
+	 */
+	pPat = etnaviv_tile_pattern(etnaviv, pTile);
+	if (pPat && etnaviv_init_src_pixmap(etnaviv, &op, pPat))
+		pTile = pPat;
+	else if (!etnaviv_init_src_pixmap(etnaviv, &op, pTile))
 		return FALSE;
 
 	op.blend_op = NULL;
 	op.src_origin_mode = SRC_ORIGIN_NONE;
-	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+	etnaviv_init_copy_rop(etnaviv, &op, pGC);
 
 	/* Convert the rectangles to a region */
 	rects = RegionFromRects(n, prect, CT_UNSORTED);
@@ -886,78 +1709,329 @@ Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 
 	nbox = RegionNumRects(rects);
 	if (nbox) {
-		int tile_w, tile_h, tile_off_x, tile_off_y;
+		xPoint tile_off;
 		BoxPtr pBox;
 
 		/* Calculate the tile offset from the rect coords */
-		tile_off_x = pDrawable->x + pGC->patOrg.x;
-		tile_off_y = pDrawable->y + pGC->patOrg.y;
-
-		tile_w = pTile->drawable.width;
-		tile_h = pTile->drawable.height;
+		tile_off.x = pDrawable->x + pGC->patOrg.x;
+		tile_off.y = pDrawable->y + pGC->patOrg.y;
 
 		pBox = RegionRects(rects);
 		while (nbox--) {
-			xPoint tile_origin;
-			int dst_y, height, tile_y;
-
 			op.clip = pBox;
 
 			etnaviv_batch_start(etnaviv, &op);
+			etnaviv_de_op_tiled(etnaviv, &op, pBox,
+					    pTile->drawable.width,
+					    pTile->drawable.height, tile_off);
+			etnaviv_de_end(etnaviv);
 
-			dst_y = pBox->y1;
-			height = pBox->y2 - dst_y;
-			modulus(dst_y - tile_off_y, tile_h, tile_y);
-
-			tile_origin.y = tile_y;
+			pBox++;
+		}
+	}
 
-			while (height > 0) {
-				int dst_x, width, tile_x, h;
+	RegionUninit(rects);
+	RegionDestroy(rects);
 
-				dst_x = pBox->x1;
-				width = pBox->x2 - dst_x;
-				modulus(dst_x - tile_off_x, tile_w, tile_x);
+	return TRUE;
+}
 
-				tile_origin.x = tile_x;
+static inline uint8_t etnaviv_bitrev8(uint8_t b)
+{
+	b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+	b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+	return b;
+}
 
-				h = tile_h - tile_origin.y;
-				if (h > height)
-					h = height;
-				height -= h;
+/*
+ * Upload a set of core font glyphs to the glyph atlas.  The glyph
+ * bitmaps are assembled into a single staging buffer, MSB-first as
+ * the monochrome source expects, and copied into the atlas as 32bpp
+ * pixels in one batch.
+ */
+static Bool etnaviv_core_glyph_upload(ScreenPtr pScreen, PixmapPtr pAtlas,
+	const struct core_glyph_upload *up, unsigned n)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vAtlas = etnaviv_get_pixmap_priv(pAtlas);
+	struct etnaviv_format fmt = { .format = DE_FORMAT_A8R8G8B8 };
+	struct etnaviv_usermem_node *unode;
+	struct etnaviv_de_op op;
+	size_t size, align = maxt(VIVANTE_ALIGN_MASK, getpagesize());
+	unsigned i, row, pitch = CORE_GLYPH_MAX_WIDTH / 8;
+	struct etna_bo *usr;
+	BoxRec clip;
+	uint8_t *buf;
+	void *b;
+
+	if (!vAtlas || !etnaviv_map_gpu(etnaviv, vAtlas, GPU_ACCESS_RW))
+		return FALSE;
 
-				while (width > 0) {
-					BoxRec dst;
-					int w;
+	for (i = row = 0; i < n; i++)
+		row += GLYPHHEIGHTPIXELS(up[i].pci);
 
-					w = tile_w - tile_origin.x;
-					if (w > width)
-						w = width;
-					width -= w;
+	size = pitch * row + align - 1;
+	size &= ~(align - 1);
 
-					box_init(&dst, dst_x, dst_y, w, h);
-					etnaviv_de_op_src_origin(etnaviv, &op,
-								 tile_origin,
-								 &dst);
+	unode = malloc(sizeof(*unode));
+	if (!unode)
+		return FALSE;
 
-					dst_x += w;
-					tile_origin.x = 0;
-				}
-				dst_y += h;
-				tile_origin.y = 0;
-			}
+	memset(unode, 0, sizeof(*unode));
 
-			etnaviv_de_end(etnaviv);
+	if (posix_memalign(&b, align, size)) {
+		free(unode);
+		return FALSE;
+	}
 
-			pBox++;
+	memset(b, 0, size);
+
+	for (i = 0, buf = b; i < n; i++) {
+		CharInfoPtr pci = up[i].pci;
+		const uint8_t *src = FONTGLYPHBITS(NULL, pci);
+		unsigned stride = GLYPHWIDTHBYTESPADDED(pci);
+		unsigned bytes = (GLYPHWIDTHPIXELS(pci) + 7) / 8;
+		unsigned h = GLYPHHEIGHTPIXELS(pci);
+		unsigned j, k;
+
+		for (j = 0; j < h; j++, src += stride, buf += pitch) {
+#if BITMAP_BIT_ORDER == LSBFirst
+			for (k = 0; k < bytes; k++)
+				buf[k] = etnaviv_bitrev8(src[k]);
+#else
+			for (k = 0; k < bytes; k++)
+				buf[k] = src[k];
+#endif
 		}
 	}
 
-	RegionUninit(rects);
-	RegionDestroy(rects);
+	usr = etna_bo_from_usermem_prot(etnaviv->conn, b, size, PROT_READ);
+	if (!usr) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etnaviv: %s: etna_bo_from_usermem_prot(ptr=%p, size=%zu) failed: %s\n",
+			   __FUNCTION__, b, size, strerror(errno));
+		free(b);
+		free(unode);
+		return FALSE;
+	}
+
+	box_init(&clip, 0, 0, CORE_GLYPH_ATLAS_WIDTH, CORE_GLYPH_ATLAS_HEIGHT);
+
+	op.dst = INIT_BLIT_PIX(vAtlas, fmt, ZERO_OFFSET);
+	op.src = INIT_BLIT_BO(usr, pitch, fmt, ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.clip = &clip;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+
+	etnaviv_batch_start(etnaviv, &op);
+	for (i = row = 0; i < n; i++) {
+		CharInfoPtr pci = up[i].pci;
+		unsigned h = GLYPHHEIGHTPIXELS(pci);
+		xPoint src_origin = { 0, row };
+		BoxRec dst;
+
+		box_init(&dst, up[i].pos.x / 32, up[i].pos.y,
+			 core_glyph_words(pci), h);
+		etnaviv_de_op_src_origin(etnaviv, &op, src_origin, &dst);
+		row += h;
+	}
+	etnaviv_de_end(etnaviv);
+
+	/* Free the staging buffer once the GPU has finished with it */
+	unode->bo = usr;
+	unode->mem = b;
+	etnaviv_add_freemem(etnaviv, unode);
 
 	return TRUE;
 }
 
+Bool etnaviv_accel_core_glyph_init(ScreenPtr pScreen)
+{
+	return core_glyph_cache_init(pScreen, etnaviv_core_glyph_upload,
+				     CREATE_PIXMAP_USAGE_GPU);
+}
+
+static void etnaviv_accel_glyph_back(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, const BoxRec *back,
+	const struct etnaviv_fill_pass *pass)
+{
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	BoxRec boxes[VIVANTE_MAX_2D_RECTS];
+	const BoxRec *box;
+	int nclip, nb;
+
+	op->src = INIT_BLIT_NULL;
+	op->blend_op = NULL;
+	op->clip = RegionExtents(clip);
+	op->src_origin_mode = SRC_ORIGIN_NONE;
+	op->rop = pass->rop;
+	op->cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op->brush = TRUE;
+	op->fg_colour = pass->colour;
+
+	etnaviv_batch_start(etnaviv, op);
+
+	nclip = RegionNumRects(clip);
+	for (nb = 0, box = RegionRects(clip); nclip; nclip--, box++) {
+		if (__box_intersect(&boxes[nb], back, box))
+			continue;
+
+		if (++nb >= VIVANTE_MAX_2D_RECTS) {
+			etnaviv_de_op(etnaviv, op, boxes, nb);
+			nb = 0;
+		}
+	}
+	if (nb)
+		etnaviv_de_op(etnaviv, op, boxes, nb);
+	etnaviv_de_end(etnaviv);
+}
+
+/*
+ * Draw a run of core font glyphs using the atlas as a monochrome
+ * source: set bits apply the foreground ROP with the brush colour,
+ * clear bits leave the destination untouched.  For ImageText, the
+ * background is filled first, and the GC function and fill style
+ * are ignored.
+ */
+static Bool etnaviv_accel_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci, Bool image)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_format fmt = { .format = DE_FORMAT_MONOCHROME };
+	struct etnaviv_pixmap *vAtlas;
+	struct etnaviv_de_op op;
+	struct etnaviv_fill_pass fg[2], bg[2];
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	const BoxRec *box;
+	PixmapPtr pAtlas;
+	BoxRec *boxes;
+	xPoint *pos;
+	unsigned i, n;
+	int nclip;
+	Bool ret = FALSE;
+
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	/* The glyphs are drawn per clip box, so only one pass is possible */
+	if (etnaviv_fill_planes(etnaviv, pGC, image ? GXcopy : pGC->alu,
+				pGC->fgPixel, fg) != 1 ||
+	    (image && etnaviv_fill_planes(etnaviv, pGC, GXcopy,
+					  pGC->bgPixel, bg) != 1))
+		return FALSE;
+
+	pos = malloc(nglyph * (sizeof(*pos) + sizeof(*boxes)));
+	if (!pos)
+		return FALSE;
+
+	boxes = (BoxRec *)(pos + nglyph);
+
+	pAtlas = core_glyph_cache_preload(pDrawable->pScreen, pGC->font,
+					  nglyph, ppci, pos);
+	if (!pAtlas)
+		goto out;
+
+	vAtlas = etnaviv_get_pixmap_priv(pAtlas);
+	if (!etnaviv_map_gpu(etnaviv, vAtlas, GPU_ACCESS_RO) ||
+	    !etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		goto out;
+
+	x += pDrawable->x;
+	y += pDrawable->y;
+
+	if (image) {
+		ExtentInfoRec info;
+		BoxRec back;
+
+		QueryGlyphExtents(pGC->font, ppci, nglyph, &info);
+
+		if (info.overallWidth > 0) {
+			back.x1 = x;
+			back.x2 = x + info.overallWidth;
+		} else {
+			back.x1 = x + info.overallWidth;
+			back.x2 = x;
+		}
+		back.y1 = y - FONTASCENT(pGC->font);
+		back.y2 = y + FONTDESCENT(pGC->font);
+
+		etnaviv_accel_glyph_back(etnaviv, &op, pGC, &back, bg);
+	}
+
+	/* Compact the glyphs which have some ink, and their positions */
+	for (i = n = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		unsigned w = GLYPHWIDTHPIXELS(pci);
+		unsigned h = GLYPHHEIGHTPIXELS(pci);
+
+		if (w && h) {
+			box_init(&boxes[n], x + pci->metrics.leftSideBearing,
+				 y - pci->metrics.ascent, w, h);
+			pos[n] = pos[i];
+			n++;
+		}
+		x += pci->metrics.characterWidth;
+	}
+
+	op.src = INIT_BLIT_BUF(fmt, vAtlas, vAtlas->etna_bo, vAtlas->pitch,
+			       ZERO_OFFSET, CORE_GLYPH_ATLAS_WIDTH * 32,
+			       CORE_GLYPH_ATLAS_HEIGHT, DE_ROT_MODE_ROT0);
+	op.blend_op = NULL;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = fg[0].rop;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = TRUE;
+	op.fg_colour = fg[0].colour;
+
+	nclip = RegionNumRects(clip);
+	for (box = RegionRects(clip); n && nclip; nclip--, box++) {
+		Bool started = FALSE;
+
+		for (i = 0; i < n; i++) {
+			BoxRec b;
+
+			if (__box_intersect(&b, &boxes[i], box))
+				continue;
+
+			if (!started) {
+				op.clip = box;
+				etnaviv_batch_start(etnaviv, &op);
+				started = TRUE;
+			}
+
+			etnaviv_de_op_src_origin(etnaviv, &op, pos[i],
+						 &boxes[i]);
+		}
+
+		if (started)
+			etnaviv_de_end(etnaviv);
+	}
+
+	ret = TRUE;
+
+ out:
+	free(pos);
+	return ret;
+}
+
+Bool etnaviv_accel_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci)
+{
+	return etnaviv_accel_glyph_blt(pDrawable, pGC, x, y, nglyph, ppci,
+				       TRUE);
+}
+
+Bool etnaviv_accel_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci)
+{
+	return etnaviv_accel_glyph_blt(pDrawable, pGC, x, y, nglyph, ppci,
+				       FALSE);
+}
+
 Bool etnaviv_accel_init(struct etnaviv *etnaviv)
 {
 	Bool pe20;
@@ -1040,6 +2114,20 @@ Bool etnaviv_accel_init(struct etnaviv *etnaviv)
 
 void etnaviv_accel_shutdown(struct etnaviv *etnaviv)
 {
+	unsigned long spans = etnaviv->span_stats.spans;
+	unsigned long drawn = etnaviv->span_stats.lines +
+			      etnaviv->span_stats.rects;
+
+	/* How many fewer GPU primitives were drawn than spans were given */
+	if (spans)
+		xf86DrvMsg(etnaviv->scrnIndex, X_INFO,
+			   "etnaviv: %lu spans drawn as %lu lines and %lu rectangles, %lu%% fewer primitives\n",
+			   spans, etnaviv->span_stats.lines,
+			   etnaviv->span_stats.rects,
+			   drawn < spans ? (spans - drawn) * 100 / spans : 0);
+
+	etnaviv_fallback_dump(etnaviv);
+
 	TimerFree(etnaviv->cache_timer);
 	etnaviv->cache_timer = NULL;
 	etna_finish(etnaviv->ctx);
@@ -9,6 +9,7 @@
 
 #include "compat-list.h"
 #include "pixmaputil.h"
+#include "etnaviv_fallback.h"
 #include "etnaviv_fence.h"
 #include "etnaviv_op.h"
 #include "etnaviv_compat_xorg.h"
@@ -19,6 +20,7 @@ struct armada_accel_ops;
 struct drm_armada_bo;
 struct drm_armada_bufmgr;
 struct etnaviv_dri2_info;
+struct etnaviv_span_acc;
 
 /* From libetnaviv */
 struct etna_bo;
@@ -76,6 +78,19 @@ enum {
 /* The size of the additional blit for GC320 */
 #define BATCH_WA_GC320_SIZE	(6 + 6 + 2 + 4 + 4)
 
+/*
+ * A persistent buffer for passing data to the GPU, which may be
+ * reused once the GPU has finished with it.
+ */
+struct etnaviv_stage {
+	struct etnaviv_fence fence;
+	struct etna_bo *bo;
+	void *ptr;
+};
+
+#define ETNAVIV_GLYPH_STAGES		4
+#define ETNAVIV_GLYPH_STAGE_SIZE	(128 * 1024)
+
 struct etnaviv {
 	struct viv_conn *conn;
 	struct etna_ctx *ctx;
@@ -87,6 +102,8 @@ struct etnaviv {
 	uint32_t bugs[1];
 	struct etnaviv_de_op gc320_wa;
 	struct etna_bo *gc320_etna_bo;
+	/* The filter blit kernel currently loaded into the GPU */
+	const uint32_t *filter_kernel;
 	int scrnIndex;
 #ifdef HAVE_DRI2
 	Bool dri2_enabled;
@@ -109,6 +126,8 @@ struct etnaviv {
 	} reloc[MAX_RELOC_SIZE];
 	unsigned int reloc_setup_size;
 	unsigned int reloc_size;
+	/* The batch has been left open, see etnaviv_de_close() */
+	Bool batch_open;
 
 	CloseScreenProcPtr CloseScreen;
 	GetImageProcPtr GetImage;
@@ -123,6 +142,7 @@ struct etnaviv {
 	CreateScreenResourcesProcPtr CreateScreenResources;
 
 	CompositeProcPtr Composite;
+	CompositeRectsProcPtr CompositeRects;
 	GlyphsProcPtr Glyphs;
 	TrapezoidsProcPtr Trapezoids;
 	TrianglesProcPtr Triangles;
@@ -130,9 +150,42 @@ struct etnaviv {
 	AddTrapsProcPtr AddTraps;
 	UnrealizeGlyphProcPtr UnrealizeGlyph;
 
+	/* Rasterised gradient sources, most recently used first */
+	struct xorg_list gradient_lru;
+	size_t gradient_size;
+
+	/* Single pixel solid colour sources, see etnaviv_solid_src() */
+	PixmapPtr solid_pixmap;
+	uint32_t solid_colour[16];
+	uint16_t solid_valid;
+	unsigned solid_next;
+
+	/* Staging buffers for glyph uploads, reused in turn */
+	struct etnaviv_stage glyph_stage[ETNAVIV_GLYPH_STAGES];
+	unsigned glyph_stage_next;
+
+	/* The composite operation of the open batch, if any */
+	struct etnaviv_de_op composite_op;
+	struct etnaviv_blend_op composite_blend;
+	BoxRec composite_clip;
+
+	/* Spans being collected from mi for the current operation */
+	struct etnaviv_span_acc *span_acc;
+	/* Spans received, and the lines and rectangles drawn for them */
+	struct {
+		unsigned long spans;
+		unsigned long lines;
+		unsigned long rects;
+	} span_stats;
+
+	/* Operations which fell back to the CPU, and why */
+	struct etnaviv_fallback_stats fallback;
+
 	struct etnaviv_xv_priv *xv;
+	struct etnaviv_xv_pool *xv_pool;
 	unsigned xv_ports;
 	CloseScreenProcPtr xv_CloseScreen;
+	RESTYPE xv_shm_type;
 };
 
 struct etnaviv_pixmap {
@@ -160,6 +213,24 @@ struct etnaviv_pixmap {
 	struct etna_bo *etna_bo;
 	uint32_t name;
 	unsigned int refcnt;
+
+	/* Incremented whenever the pixmap is mapped for writing */
+	unsigned int serial;
+
+	/* This pixmap replicated for use as a tile, and its serial */
+	PixmapPtr tile_pattern;
+	unsigned int tile_pattern_serial;
+
+	/* This pixmap mirrored for RepeatReflect, and its serial */
+	PixmapPtr reflect_pattern;
+	unsigned int reflect_pattern_serial;
+
+	/* Tile analysis, valid while tile_serial matches serial */
+	unsigned int tile_serial;
+	uint8_t tile_flags;
+#define TILE_ANALYSED	(1 << 0)
+#define TILE_SOLID	(1 << 1)
+	uint32_t tile_pixel;
 };
 
 struct etnaviv_usermem_node {
@@ -171,6 +242,14 @@ struct etnaviv_usermem_node {
 void etnaviv_add_freemem(struct etnaviv *etnaviv,
 	struct etnaviv_usermem_node *n);
 
+struct etnaviv_span_acc {
+	DrawablePtr pDrawable;
+	GCPtr pGC;
+	BoxRec *boxes;
+	unsigned int n;
+	unsigned int size;
+};
+
 static inline void etnaviv_enable_bugfix(struct etnaviv *etnaviv,
 	unsigned int bug)
 {
@@ -206,27 +285,59 @@ Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	int npt, DDXPointPtr ppt);
 Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
 	xSegment *pSeg);
+Bool etnaviv_accel_PolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int n,
+	xRectangle *prect);
 Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
 Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
+Bool etnaviv_accel_span_start(struct etnaviv_span_acc *acc,
+	DrawablePtr pDrawable, GCPtr pGC);
+void etnaviv_accel_span_end(struct etnaviv_span_acc *acc);
+Bool etnaviv_accel_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci);
+Bool etnaviv_accel_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci);
+Bool etnaviv_accel_core_glyph_init(ScreenPtr pScreen);
 
 void etnaviv_commit(struct etnaviv *etnaviv, Bool stall);
 void etnaviv_finish_fences(struct etnaviv *etnaviv, uint32_t fence);
 
+void etnaviv_fence_wait(struct etnaviv *etnaviv, struct etnaviv_fence *f);
 void etnaviv_batch_wait_commit(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix);
+void etnaviv_batch_add(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix);
 void etnaviv_batch_start(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op);
 
+PixmapPtr etnaviv_tile_pattern(struct etnaviv *etnaviv, PixmapPtr pTile);
+PixmapPtr etnaviv_reflect_pattern(struct etnaviv *etnaviv, PixmapPtr pPix);
+void etnaviv_de_op_tiled(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *pBox,
+	int tile_w, int tile_h, xPoint tile_off);
+
 void etnaviv_accel_shutdown(struct etnaviv *);
 Bool etnaviv_accel_init(struct etnaviv *);
 
+/* Record why the current operation is falling back */
+static inline Bool etnaviv_fallback(struct etnaviv *etnaviv,
+	enum etnaviv_fallback_reason reason)
+{
+	etnaviv->fallback.reason = reason;
+	return FALSE;
+}
+
 static inline struct etnaviv_pixmap *etnaviv_get_pixmap_priv(PixmapPtr pixmap)
 {
 	extern etnaviv_Key etnaviv_pixmap_index;
 	return etnaviv_GetKeyPriv(&pixmap->devPrivates, &etnaviv_pixmap_index);
 }
 
+static inline Bool etnaviv_tile_analysed(struct etnaviv_pixmap *vPix)
+{
+	return vPix && vPix->tile_flags & TILE_ANALYSED &&
+	       vPix->tile_serial == vPix->serial;
+}
+
 static inline struct etnaviv_pixmap *etnaviv_drawable_offset(
 	DrawablePtr pDrawable, xPoint *offset)
 {
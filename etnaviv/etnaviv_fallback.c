@@ -0,0 +1,197 @@
+/*
+ * Vivante GPU Acceleration Xorg driver
+ *
+ * Fallback accounting.  The table is logged when the screen closes,
+ * and is published as the ETNAVIV_FALLBACKS property on the root
+ * window, so it can be read at any time with xprop -root.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86.h"
+#include "property.h"
+#include <X11/Xatom.h>
+
+#include "etnaviv_accel.h"
+#include "etnaviv_fallback.h"
+
+/* Minimum interval between property updates, in milliseconds */
+#define FALLBACK_UPDATE_INTERVAL	1000
+
+static const char *etnaviv_fallback_op_names[FB_NUM_OPS] = {
+	[FB_OP_COMPOSITE] = "Composite",
+	[FB_OP_COMPOSITE_RECTS] = "CompositeRects",
+	[FB_OP_GLYPHS] = "Glyphs",
+	[FB_OP_TRAPEZOIDS] = "Trapezoids",
+	[FB_OP_TRIANGLES] = "Triangles",
+	[FB_OP_FILL_SPANS] = "FillSpans",
+	[FB_OP_SET_SPANS] = "SetSpans",
+	[FB_OP_PUT_IMAGE] = "PutImage",
+	[FB_OP_GET_IMAGE] = "GetImage",
+	[FB_OP_COPY_AREA] = "CopyArea",
+	[FB_OP_COPY_PLANE] = "CopyPlane",
+	[FB_OP_POLY_POINT] = "PolyPoint",
+	[FB_OP_POLY_LINES] = "PolyLines",
+	[FB_OP_POLY_SEGMENT] = "PolySegment",
+	[FB_OP_POLY_FILL_RECT] = "PolyFillRect",
+	[FB_OP_IMAGE_GLYPH] = "ImageGlyphBlt",
+	[FB_OP_POLY_GLYPH] = "PolyGlyphBlt",
+	[FB_OP_PUSH_PIXELS] = "PushPixels",
+};
+
+static const char *etnaviv_fallback_reason_names[FB_NUM_REASONS] = {
+	[FB_UNKNOWN] = "other",
+	[FB_FORCED] = "forced",
+	[FB_ALPHA_MAP] = "alpha map",
+	[FB_FORMAT] = "format",
+	[FB_OPERATOR] = "operator",
+	[FB_TRANSFORM] = "transform",
+	[FB_PE10] = "PE1.0",
+	[FB_NO_GPU] = "no GPU buffer",
+	[FB_NO_MEMORY] = "allocation",
+	[FB_GLYPH_CACHE] = "glyph cache",
+	[FB_OVERLAP] = "glyph overlap",
+	[FB_GC] = "GC state",
+	[FB_NO_ACCEL] = "not accelerated",
+};
+
+static uint64_t etnaviv_fallback_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void etnaviv_fallback_start(struct etnaviv *etnaviv,
+	enum etnaviv_fallback_op op, struct etnaviv_fallback_timer *t)
+{
+	t->op = op;
+	t->reason = etnaviv->force_fallback ? FB_FORCED :
+		    etnaviv->fallback.reason;
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
+	/*
+	 * fb and mi may call back through the GC ops, which would count
+	 * the same work twice.  Only account for the outermost fallback.
+	 */
+	t->nested = etnaviv->fallback.depth++ != 0;
+	if (t->nested)
+		return;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->start);
+}
+
+void etnaviv_fallback_end(struct etnaviv *etnaviv,
+	struct etnaviv_fallback_timer *t)
+{
+	struct etnaviv_fallback_stats *stats = &etnaviv->fallback;
+	struct timespec end;
+
+	stats->depth--;
+	if (t->nested)
+		return;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	stats->count[t->op][t->reason]++;
+	stats->cpu_ns[t->op][t->reason] += etnaviv_fallback_ns(&end) -
+					   etnaviv_fallback_ns(&t->start);
+	stats->dirty = TRUE;
+}
+
+/*
+ * Format the table, one line per operation and reason, with the
+ * operations costing the most CPU time first.
+ */
+static size_t etnaviv_fallback_format(struct etnaviv *etnaviv, char *buf,
+	size_t size)
+{
+	struct etnaviv_fallback_stats *stats = &etnaviv->fallback;
+	Bool done[FB_NUM_OPS][FB_NUM_REASONS];
+	size_t len = 0;
+
+	memset(done, 0, sizeof(done));
+
+	while (len < size) {
+		unsigned op, reason, best_op = 0, best_reason = 0;
+		uint64_t best = 0;
+		Bool found = FALSE;
+		int n;
+
+		for (op = 0; op < FB_NUM_OPS; op++)
+			for (reason = 0; reason < FB_NUM_REASONS; reason++) {
+				if (done[op][reason] ||
+				    !stats->count[op][reason])
+					continue;
+				if (!found || stats->cpu_ns[op][reason] > best) {
+					best = stats->cpu_ns[op][reason];
+					best_op = op;
+					best_reason = reason;
+					found = TRUE;
+				}
+			}
+
+		if (!found)
+			break;
+
+		done[best_op][best_reason] = TRUE;
+
+		n = snprintf(buf + len, size - len, "%s: %s: %lu calls, %llu us\n",
+			     etnaviv_fallback_op_names[best_op],
+			     etnaviv_fallback_reason_names[best_reason],
+			     stats->count[best_op][best_reason],
+			     (unsigned long long)best / 1000);
+		if (n < 0)
+			break;
+		len += n;
+	}
+
+	return len < size ? len : size - 1;
+}
+
+/* Publish the table on the root window, at most once a second */
+void etnaviv_fallback_update(ScreenPtr pScreen)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_fallback_stats *stats = &etnaviv->fallback;
+	static const char name[] = "ETNAVIV_FALLBACKS";
+	CARD32 now;
+	char buf[4096];
+	size_t len;
+
+	if (!stats->dirty || !pScreen->root)
+		return;
+
+	now = GetTimeInMillis();
+	if ((int)(now - stats->last_update) < FALLBACK_UPDATE_INTERVAL)
+		return;
+
+	stats->dirty = FALSE;
+	stats->last_update = now;
+
+	len = etnaviv_fallback_format(etnaviv, buf, sizeof(buf));
+
+	dixChangeWindowProperty(serverClient, pScreen->root,
+				MakeAtom(name, sizeof(name) - 1, TRUE),
+				XA_STRING, 8, PropModeReplace, len, buf, FALSE);
+}
+
+void etnaviv_fallback_dump(struct etnaviv *etnaviv)
+{
+	char buf[4096], *line, *next;
+
+	if (!etnaviv_fallback_format(etnaviv, buf, sizeof(buf)))
+		return;
+
+	for (line = buf; *line; line = next) {
+		next = strchr(line, '\n');
+		if (!next)
+			break;
+		*next++ = '\0';
+		xf86DrvMsg(etnaviv->scrnIndex, X_INFO,
+			   "etnaviv: fallback %s\n", line);
+	}
+}
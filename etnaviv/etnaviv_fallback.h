@@ -0,0 +1,88 @@
+/*
+ * Vivante GPU Acceleration Xorg driver
+ *
+ * Fallback accounting.  Operations which can not be accelerated are
+ * counted by operation and reason, along with the CPU time spent
+ * performing them.
+ */
+#ifndef ETNAVIV_FALLBACK_H
+#define ETNAVIV_FALLBACK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "xf86.h"
+
+struct etnaviv;
+
+enum etnaviv_fallback_op {
+	FB_OP_COMPOSITE,
+	FB_OP_COMPOSITE_RECTS,
+	FB_OP_GLYPHS,
+	FB_OP_TRAPEZOIDS,
+	FB_OP_TRIANGLES,
+	FB_OP_FILL_SPANS,
+	FB_OP_SET_SPANS,
+	FB_OP_PUT_IMAGE,
+	FB_OP_GET_IMAGE,
+	FB_OP_COPY_AREA,
+	FB_OP_COPY_PLANE,
+	FB_OP_POLY_POINT,
+	FB_OP_POLY_LINES,
+	FB_OP_POLY_SEGMENT,
+	FB_OP_POLY_FILL_RECT,
+	FB_OP_IMAGE_GLYPH,
+	FB_OP_POLY_GLYPH,
+	FB_OP_PUSH_PIXELS,
+	FB_NUM_OPS,
+};
+
+enum etnaviv_fallback_reason {
+	FB_UNKNOWN,		/* the failing site did not say */
+	FB_FORCED,		/* acceleration disabled */
+	FB_ALPHA_MAP,		/* picture has an alpha map */
+	FB_FORMAT,		/* unsupported picture format */
+	FB_OPERATOR,		/* unsupported RENDER operator */
+	FB_TRANSFORM,		/* unsupported transform or filter */
+	FB_PE10,		/* not possible with PE1.0 blending */
+	FB_NO_GPU,		/* drawable not backed by a GPU buffer */
+	FB_NO_MEMORY,		/* allocation failure */
+	FB_GLYPH_CACHE,		/* glyph could not be cached */
+	FB_OVERLAP,		/* overlapping glyphs without a mask */
+	FB_GC,			/* unsupported GC state */
+	FB_NO_ACCEL,		/* operation has no GPU path */
+	FB_NUM_REASONS,
+};
+
+struct etnaviv_fallback_stats {
+	enum etnaviv_fallback_reason reason;
+	unsigned depth;
+	Bool dirty;
+	CARD32 last_update;
+	unsigned long count[FB_NUM_OPS][FB_NUM_REASONS];
+	uint64_t cpu_ns[FB_NUM_OPS][FB_NUM_REASONS];
+};
+
+struct etnaviv_fallback_timer {
+	enum etnaviv_fallback_op op;
+	enum etnaviv_fallback_reason reason;
+	Bool nested;
+	struct timespec start;
+};
+
+void etnaviv_fallback_start(struct etnaviv *etnaviv,
+	enum etnaviv_fallback_op op, struct etnaviv_fallback_timer *t);
+void etnaviv_fallback_end(struct etnaviv *etnaviv,
+	struct etnaviv_fallback_timer *t);
+void etnaviv_fallback_update(ScreenPtr pScreen);
+void etnaviv_fallback_dump(struct etnaviv *etnaviv);
+
+/* Run an unaccelerated operation, accounting for it */
+#define etnaviv_fallback_run(etnaviv, op, call) do {			\
+		struct etnaviv_fallback_timer __fbt;			\
+		etnaviv_fallback_start(etnaviv, op, &__fbt);		\
+		call;							\
+		etnaviv_fallback_end(etnaviv, &__fbt);			\
+	} while (0)
+
+#endif
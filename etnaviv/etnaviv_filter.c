@@ -0,0 +1,217 @@
+/*
+ * Vivante GPU Acceleration Xorg driver
+ *
+ * Filter blit kernel support.  The VR filter blit engine uses a nine
+ * tap kernel, which is shared between Xv and scaled RENDER sources.
+ *
+ * When downscaling, a kernel designed for 1:1 sampling aliases, so
+ * each filter is also precomputed with its cut-off frequency lowered
+ * for a set of downscaling ratios.  The kernel states are only
+ * emitted when the selected kernel changes, or once per batch.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+
+#include "xf86.h"
+
+#include "utils.h"
+
+#include "etnaviv_accel.h"
+#include "etnaviv_filter.h"
+
+#include <etnaviv/etna.h>
+#include <etnaviv/state_2d.xml.h>
+#include "etnaviv_compat.h"
+
+#define KERNEL_ROWS	17
+#define KERNEL_INDICES	9
+#define KERNEL_SIZE	(KERNEL_ROWS * KERNEL_INDICES)
+#define KERNEL_STATE_SZ	((KERNEL_SIZE + 1) / 2)
+
+#define LANCZOS_RADIUS	4.0
+#define BICUBIC_A	-0.5
+#define BICUBIC_MAX_RATIO	2.0
+
+/*
+ * Downscaling ratios (source pixels per destination pixel) for which
+ * kernels are precomputed.  A kernel for ratio r has its cut-off at
+ * 1/r of the source sampling frequency, widening it by r.  The nine
+ * taps reach at least 4 source pixels either side of the sample:
+ * bilinear, with a support of r, fits up to 4:1, but bicubic, with a
+ * support of 2r, only fits up to 2:1 and is not widened further.
+ * Lanczos shrinks its lobes instead.
+ */
+static const float etnaviv_filter_ratios[] = { 1.0, 1.5, 2.0, 3.0, 4.0 };
+
+#define NUM_RATIOS	ARRAY_SIZE(etnaviv_filter_ratios)
+
+static uint32_t etnaviv_filter_kernels[ETNAVIV_NUM_FILTERS][NUM_RATIOS]
+				     [KERNEL_STATE_SZ];
+static Bool etnaviv_filter_initialised;
+
+static inline float sinc(float x)
+{
+	return x != 0.0 ? sinf(x) / x : 1.0;
+}
+
+/*
+ * The weight of a tap at distance x from the sample position, for a
+ * kernel widened by ratio.
+ */
+static float etnaviv_filter_weight(enum etnaviv_filter filter, float x,
+	float ratio)
+{
+	float radius;
+
+	switch (filter) {
+	case ETNAVIV_FILTER_NEAREST:
+		/* Select the single tap closest to the sample position */
+		return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+
+	case ETNAVIV_FILTER_BILINEAR:
+		x = fabs(x / ratio);
+		return x < 1.0 ? 1.0 - x : 0.0;
+
+	case ETNAVIV_FILTER_BICUBIC:
+		/* Keys' cubic convolution, as used by Catmull-Rom splines */
+		if (ratio > BICUBIC_MAX_RATIO)
+			ratio = BICUBIC_MAX_RATIO;
+		x = fabs(x / ratio);
+		if (x < 1.0)
+			return ((BICUBIC_A + 2.0) * x - (BICUBIC_A + 3.0)) *
+			       x * x + 1.0;
+		if (x < 2.0)
+			return ((BICUBIC_A * x - 5.0 * BICUBIC_A) * x +
+				8.0 * BICUBIC_A) * x - 4.0 * BICUBIC_A;
+		break;
+
+	case ETNAVIV_FILTER_LANCZOS:
+		/* Shrink the lobes so that the widened kernel fits the taps */
+		radius = LANCZOS_RADIUS / ratio;
+		if (radius < 1.0)
+			radius = 1.0;
+		x /= ratio;
+		if (fabs(x) <= radius)
+			return sinc(M_PI * x) * sinc(M_PI * x / radius);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0.0;
+}
+
+/*
+ * Some interesting observations of the kernel.  According to the etnaviv
+ * rnndb files:
+ *  - there are 128 states which hold the kernel.
+ *  - each entry contains 9 coefficients (one for each filter tap).
+ *  - the entries are indexed by 5 bits from the fractional coordinate
+ *    (which makes 32 entries.)
+ *
+ * As the kernel table is symmetrical around the centre of the fractional
+ * coordinate, only half of the entries need to be stored.  In other words,
+ * these pairs of indices should be the same:
+ *
+ *  00=31 01=30 02=29 03=28 04=27 05=26 06=25 07=24
+ *  08=23 09=22 10=21 11=20 12=19 13=18 14=17 15=16
+ *
+ * This means that there are only 16 entries.  However, etnaviv
+ * documentation says 17 are required.  What's the additional entry?
+ *
+ * The next issue is that the filter code always produces zero for the
+ * ninth filter tap.  If this is always zero, what's the point of having
+ * hardware deal with nine filter taps?  This makes no sense to me.
+ */
+static void etnaviv_filter_init_kernel(enum etnaviv_filter filter,
+	float ratio, uint32_t *state)
+{
+	unsigned row, idx, i;
+	int16_t kernel_val[KERNEL_STATE_SZ * 2];
+	float row_ofs = 0.5;
+
+	for (row = i = 0; row < KERNEL_ROWS; row++) {
+		float kernel[KERNEL_INDICES] = { 0.0 };
+		float sum = 0.0;
+
+		for (idx = 0; idx < KERNEL_INDICES; idx++) {
+			float x = idx - 4.0 + row_ofs;
+
+			kernel[idx] = etnaviv_filter_weight(filter, x, ratio);
+			sum += kernel[idx];
+		}
+
+		/* normalise the row */
+		if (sum)
+			for (idx = 0; idx < KERNEL_INDICES; idx++)
+				kernel[idx] /= sum;
+
+		/* convert to 1.14 format */
+		for (idx = 0; idx < KERNEL_INDICES; idx++) {
+			int val = kernel[idx] * (float)(1 << 14);
+
+			if (val < -0x8000)
+				val = -0x8000;
+			else if (val > 0x7fff)
+				val = 0x7fff;
+
+			kernel_val[i++] = val;
+		}
+
+		row_ofs -= 1.0 / ((KERNEL_ROWS - 1) * 2);
+	}
+
+	kernel_val[KERNEL_SIZE] = 0;
+
+	/* Now convert the kernel values into state values */
+	for (i = 0; i < KERNEL_STATE_SZ * 2; i += 2)
+		state[i / 2] =
+			VIVS_DE_FILTER_KERNEL_COEFFICIENT0(kernel_val[i]) |
+			VIVS_DE_FILTER_KERNEL_COEFFICIENT1(kernel_val[i + 1]);
+}
+
+void etnaviv_filter_init(void)
+{
+	unsigned i, j;
+
+	if (etnaviv_filter_initialised)
+		return;
+
+	for (i = 0; i < ETNAVIV_NUM_FILTERS; i++)
+		for (j = 0; j < NUM_RATIOS; j++)
+			etnaviv_filter_init_kernel(i, etnaviv_filter_ratios[j],
+						   etnaviv_filter_kernels[i][j]);
+
+	etnaviv_filter_initialised = TRUE;
+}
+
+/*
+ * Load the kernel for a filter pass with the 16.16 fixed point scale
+ * (source pixels per destination pixel.)  Upscaling and 1:1 use the
+ * full bandwidth kernel.
+ */
+void etnaviv_filter_load(struct etnaviv *etnaviv, enum etnaviv_filter filter,
+	uint32_t scale)
+{
+	const uint32_t *kernel;
+	unsigned i;
+
+	for (i = NUM_RATIOS - 1; i > 0; i--)
+		if (scale >= (uint32_t)(etnaviv_filter_ratios[i] * 65536.0))
+			break;
+
+	kernel = etnaviv_filter_kernels[filter][i];
+	if (etnaviv->filter_kernel == kernel)
+		return;
+
+	etnaviv_de_close(etnaviv);
+
+	etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0),
+			     KERNEL_STATE_SZ, kernel);
+
+	etnaviv->filter_kernel = kernel;
+}
@@ -0,0 +1,25 @@
+/*
+ * Vivante GPU Acceleration Xorg driver
+ *
+ * Filter blit kernel support.
+ */
+#ifndef ETNAVIV_FILTER_H
+#define ETNAVIV_FILTER_H
+
+#include <stdint.h>
+
+struct etnaviv;
+
+enum etnaviv_filter {
+	ETNAVIV_FILTER_NEAREST,
+	ETNAVIV_FILTER_BILINEAR,
+	ETNAVIV_FILTER_BICUBIC,
+	ETNAVIV_FILTER_LANCZOS,
+	ETNAVIV_NUM_FILTERS,
+};
+
+void etnaviv_filter_init(void);
+void etnaviv_filter_load(struct etnaviv *etnaviv, enum etnaviv_filter filter,
+	uint32_t scale);
+
+#endif
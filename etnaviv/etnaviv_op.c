@@ -97,8 +97,14 @@ static inline uint32_t etnaviv_src_config(struct etnaviv_format fmt,
 {
 	uint32_t src_cfg;
 
+	/*
+	 * Monochrome sources are used as a mask: the ROP4 foreground
+	 * ROP is applied where the source bit is set, the background
+	 * ROP where it is clear.
+	 */
 	src_cfg = VIVS_DE_SRC_CONFIG_PE10_SOURCE_FORMAT(fmt.format) |
-		  VIVS_DE_SRC_CONFIG_TRANSPARENCY(0) |
+		  VIVS_DE_SRC_CONFIG_TRANSPARENCY(fmt.format ==
+						  DE_FORMAT_MONOCHROME) |
 		  VIVS_DE_SRC_CONFIG_LOCATION_MEMORY |
 		  VIVS_DE_SRC_CONFIG_PACK_PACKED8 |
 		  VIVS_DE_SRC_CONFIG_SWIZZLE(fmt.swizzle) |
@@ -209,9 +215,10 @@ static void etnaviv_set_blend(struct etnaviv *etnaviv,
 
 		if (pe20) {
 			EL(LOADSTATE(VIVS_DE_GLOBAL_SRC_COLOR, 3));
-			EL(op->src_alpha << 24);
+			EL(op->src_alpha << 24 | op->src_colour);
 			EL(op->dst_alpha << 24);
-			EL(VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_DISABLE |
+			EL(op->colour_mode ? op->colour_mode :
+			   VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_DISABLE |
 			   VIVS_DE_COLOR_MULTIPLY_MODES_DST_PREMULTIPLY_DISABLE |
 			   VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_DISABLE |
 			   VIVS_DE_COLOR_MULTIPLY_MODES_DST_DEMULTIPLY_DISABLE);
@@ -262,19 +269,39 @@ static void etnaviv_emit_2d_draw(struct etnaviv *etnaviv, const BoxRec *pbox,
 
 static void de_start(struct etnaviv *etnaviv, const struct etnaviv_de_op *op)
 {
+	unsigned bg_rop;
+
 	if (op->src.bo)
 		etnaviv_set_source_bo(etnaviv, &op->src, op->src_origin_mode);
 	etnaviv_set_dest_bo(etnaviv, &op->dst, op->cmd);
 	etnaviv_set_blend(etnaviv, op->blend_op);
 	if (op->brush)
 		etnaviv_emit_brush(etnaviv, op->fg_colour);
-	etnaviv_emit_rop_clip(etnaviv, op->rop, op->rop, op->clip,
+	/* Leave the destination untouched for clear monochrome bits */
+	bg_rop = op->src.format.format == DE_FORMAT_MONOCHROME ? 0xaa : op->rop;
+
+	etnaviv_emit_rop_clip(etnaviv, op->rop, bg_rop, op->clip,
 			      op->dst.offset);
 	etnaviv_emit_src_rotate(etnaviv, &op->src);
+
+	/*
+	 * Stretch blits are only used to replicate a single source
+	 * pixel over the destination, so the stretch factors are zero.
+	 */
+	if (op->cmd == VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT) {
+		EL_START(etnaviv, 4);
+		EL(LOADSTATE(VIVS_DE_STRETCH_FACTOR_LOW, 2));
+		EL(0);
+		EL(0);
+		EL_ALIGN();
+		EL_END();
+	}
 }
 
 void etnaviv_de_start(struct etnaviv *etnaviv, const struct etnaviv_de_op *op)
 {
+	etnaviv_de_close(etnaviv);
+
 	BATCH_SETUP_START(etnaviv);
 	de_start(etnaviv, op);
 	BATCH_SETUP_END(etnaviv);
@@ -309,6 +336,20 @@ void etnaviv_de_end(struct etnaviv *etnaviv)
 	etnaviv_emit(etnaviv);
 }
 
+/*
+ * A batch may be left open after its last operation, so that a
+ * following identical operation can add further boxes to it without
+ * starting a new batch.  Anything else which uses the batch buffer or
+ * the command stream must close it first.
+ */
+void etnaviv_de_close(struct etnaviv *etnaviv)
+{
+	if (etnaviv->batch_open) {
+		etnaviv->batch_open = FALSE;
+		etnaviv_de_end(etnaviv);
+	}
+}
+
 void etnaviv_de_op_src_origin(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op, xPoint src_origin, const BoxRec *dest)
 {
@@ -415,6 +456,8 @@ void etnaviv_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
 {
 	uint32_t cfg, offset, pitch;
 
+	etnaviv_de_close(etnaviv);
+
 	cfg = etnaviv_src_config(op->src.format, FALSE);
 	offset = op->src_offsets ? op->src_offsets[0] : 0;
 	pitch = op->src_pitches ? op->src_pitches[0] : op->src.pitch;
@@ -502,6 +545,8 @@ void etnaviv_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
 void etnaviv_flush(struct etnaviv *etnaviv)
 {
 	struct etna_ctx *ctx = etnaviv->ctx;
+
+	etnaviv_de_close(etnaviv);
 	etna_set_state(ctx, VIVS_GL_FLUSH_CACHE, VIVS_GL_FLUSH_CACHE_PE2D);
 	etna_set_state(ctx, VIVS_GL_FLUSH_CACHE, VIVS_GL_FLUSH_CACHE_PE2D);
 }
@@ -32,6 +32,8 @@ struct etnaviv_blend_op {
 	uint8_t dst_mode;	/* DE_BLENDMODE_xx */
 	uint8_t src_alpha;
 	uint8_t dst_alpha;
+	uint32_t src_colour;	/* PE2.0 global source colour (RGB) */
+	uint32_t colour_mode;	/* PE2.0 VIVS_DE_COLOR_MULTIPLY_MODES_xx */
 };
 
 struct etnaviv_blit_buf {
@@ -101,6 +103,7 @@ struct etnaviv_vr_op {
 
 void etnaviv_de_start(struct etnaviv *etnaviv, const struct etnaviv_de_op *op);
 void etnaviv_de_end(struct etnaviv *etnaviv);
+void etnaviv_de_close(struct etnaviv *etnaviv);
 void etnaviv_de_op_src_origin(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op, xPoint src_origin, const BoxRec *dest);
 void etnaviv_de_op(struct etnaviv *etnaviv, const struct etnaviv_de_op *op,
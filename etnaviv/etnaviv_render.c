@@ -8,10 +8,9 @@
 #include "config.h"
 #endif
 
-#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
-#include <sys/mman.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef HAVE_DIX_CONFIG_H
@@ -27,6 +26,7 @@
 #include "fbpict.h"
 
 #include "boxutil.h"
+#include "cpu_access.h"
 #include "glyph_assemble.h"
 #include "glyph_cache.h"
 #include "glyph_extents.h"
@@ -35,6 +35,7 @@
 #include "unaccel.h"
 
 #include "etnaviv_accel.h"
+#include "etnaviv_filter.h"
 #include "etnaviv_render.h"
 #include "etnaviv_utils.h"
 
@@ -319,6 +320,62 @@ static struct etnaviv_pixmap *etnaviv_get_scratch_argb(ScreenPtr pScreen,
 	return vpix;
 }
 
+/*
+ * Solid colour sources for PE2.0 stretch blits.  Recently used colours
+ * are kept as single pixels in a small pixmap; a colour is written
+ * into its pixel by the GPU, queued behind any earlier users of the
+ * pixel's previous colour.
+ */
+static struct etnaviv_pixmap *etnaviv_solid_src(ScreenPtr pScreen,
+	uint32_t colour, xPoint *origin)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vSolid;
+	BoxRec box;
+	unsigned i, n = ARRAY_SIZE(etnaviv->solid_colour);
+
+	if (!etnaviv->solid_pixmap) {
+		etnaviv->solid_pixmap = pScreen->CreatePixmap(pScreen, n, 1,
+						32, CREATE_PIXMAP_USAGE_GPU);
+		if (!etnaviv->solid_pixmap)
+			return NULL;
+		etnaviv->solid_valid = 0;
+	}
+
+	vSolid = etnaviv_get_pixmap_priv(etnaviv->solid_pixmap);
+	if (!vSolid)
+		return NULL;
+
+	vSolid->pict_format = etnaviv_pict_format(PICT_a8r8g8b8);
+
+	for (i = 0; i < n; i++)
+		if (etnaviv->solid_valid & (1 << i) &&
+		    etnaviv->solid_colour[i] == colour)
+			goto found;
+
+	i = etnaviv->solid_next;
+	etnaviv->solid_next = (i + 1) % n;
+
+	box_init(&box, i, 0, 1, 1);
+	if (!etnaviv_fill_single(etnaviv, vSolid, &box, colour))
+		return NULL;
+
+	etnaviv->solid_colour[i] = colour;
+	etnaviv->solid_valid |= 1 << i;
+
+ found:
+	origin->x = i;
+	origin->y = 0;
+
+	return vSolid;
+}
+
+static uint32_t etnaviv_render_colour_argb(const xRenderColor *colour)
+{
+	return (colour->alpha >> 8) << 24 | (colour->red >> 8) << 16 |
+	       (colour->green >> 8) << 8 | colour->blue >> 8;
+}
+
 static Bool etnaviv_pict_solid_argb(PicturePtr pict, uint32_t *col)
 {
 	unsigned r, g, b, a, rbits, gbits, bbits, abits;
@@ -360,10 +417,7 @@ static Bool etnaviv_pict_solid_argb(PicturePtr pict, uint32_t *col)
 		break;
 	case PictTypeIndexed:
 		miRenderPixelToColor(pFormat, pixel, &colour);
-		argb = (colour.alpha >> 8) << 24;
-		argb |= (colour.red >> 8) << 16;
-		argb |= (colour.green >> 8) << 8;
-		argb |= (colour.blue >> 8);
+		argb = etnaviv_render_colour_argb(&colour);
 		break;
 	default:
 		/* unknown type, just assume pixel value */
@@ -403,6 +457,204 @@ static Bool etnaviv_composite_to_pixmap(CARD8 op, PicturePtr pSrc,
 	return TRUE;
 }
 
+/*
+ * Gradient sources are rasterised by pixman, which is expensive, and
+ * toolkits tend to draw the same gradients repeatedly.  Keep the
+ * rasterised images in GPU pixmaps, keyed by the gradient description
+ * and the area of the source which was rasterised, and evict the least
+ * recently used images when the cache exceeds its budget.
+ */
+#define GRADIENT_CACHE_BUDGET	(4 << 20)
+#define GRADIENT_MAX_SIZE	(GRADIENT_CACHE_BUDGET / 4)
+#define GRADIENT_MAX_STOPS	64
+#define GRADIENT_KEY_MAX	(20 + 3 * GRADIENT_MAX_STOPS)
+
+struct etnaviv_gradient {
+	struct xorg_list node;
+	PixmapPtr pixmap;
+	BoxRec extent;		/* in source picture coordinates */
+	size_t size;
+	uint32_t hash;
+	unsigned key_len;
+	uint32_t key[];
+};
+
+static unsigned etnaviv_gradient_key(PicturePtr pict, uint32_t *key)
+{
+	SourcePict *sp = pict->pSourcePict;
+	unsigned i, n = 0;
+
+	if (!sp || sp->gradient.nstops > GRADIENT_MAX_STOPS)
+		return 0;
+
+	key[n++] = sp->type;
+	key[n++] = pict->repeat ? pict->repeatType + 1 : 0;
+	key[n++] = pict->filter;
+
+	switch (sp->type) {
+	case SourcePictTypeLinear:
+		key[n++] = sp->linear.p1.x;
+		key[n++] = sp->linear.p1.y;
+		key[n++] = sp->linear.p2.x;
+		key[n++] = sp->linear.p2.y;
+		break;
+	case SourcePictTypeRadial:
+		key[n++] = sp->radial.c1.x;
+		key[n++] = sp->radial.c1.y;
+		key[n++] = sp->radial.c1.radius;
+		key[n++] = sp->radial.c2.x;
+		key[n++] = sp->radial.c2.y;
+		key[n++] = sp->radial.c2.radius;
+		break;
+	case SourcePictTypeConical:
+		key[n++] = sp->conical.center.x;
+		key[n++] = sp->conical.center.y;
+		key[n++] = sp->conical.angle;
+		break;
+	default:
+		return 0;
+	}
+
+	if (pict->transform) {
+		unsigned j;
+
+		for (i = 0; i < 3; i++)
+			for (j = 0; j < 3; j++)
+				key[n++] = pict->transform->matrix[i][j];
+	}
+
+	key[n++] = sp->gradient.nstops;
+	for (i = 0; i < sp->gradient.nstops; i++) {
+		PictGradientStopPtr stop = &sp->gradient.stops[i];
+
+		key[n++] = stop->x;
+		key[n++] = stop->color.red << 16 | stop->color.green;
+		key[n++] = stop->color.blue << 16 | stop->color.alpha;
+	}
+
+	return n;
+}
+
+static uint32_t etnaviv_gradient_hash(const uint32_t *key, unsigned n)
+{
+	uint32_t hash = 2166136261U;
+
+	while (n--)
+		hash = (hash ^ *key++) * 16777619U;
+
+	return hash;
+}
+
+static void etnaviv_gradient_free(ScreenPtr pScreen,
+	struct etnaviv_gradient *g)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+
+	etnaviv->gradient_size -= g->size;
+	xorg_list_del(&g->node);
+	pScreen->DestroyPixmap(g->pixmap);
+	free(g);
+}
+
+static void etnaviv_gradient_cache_fini(ScreenPtr pScreen)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_gradient *g, *n;
+
+	xorg_list_for_each_entry_safe(g, n, &etnaviv->gradient_lru, node)
+		etnaviv_gradient_free(pScreen, g);
+}
+
+/*
+ * Acquire a gradient picture from the cache, rasterising it if the
+ * area required is not already present.  src_topleft is adjusted to
+ * be relative to the cached pixmap.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_gradient(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, xPoint *src_topleft)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_gradient *g;
+	struct etnaviv_pixmap *vPix;
+	uint32_t key[GRADIENT_KEY_MAX], hash;
+	unsigned key_len;
+	BoxRec want;
+	size_t size;
+
+	key_len = etnaviv_gradient_key(pict, key);
+	if (!key_len)
+		return NULL;
+
+	hash = etnaviv_gradient_hash(key, key_len);
+
+	want.x1 = src_topleft->x + clip->x1;
+	want.y1 = src_topleft->y + clip->y1;
+	want.x2 = src_topleft->x + clip->x2;
+	want.y2 = src_topleft->y + clip->y2;
+
+	xorg_list_for_each_entry(g, &etnaviv->gradient_lru, node) {
+		if (g->hash == hash && g->key_len == key_len &&
+		    g->extent.x1 <= want.x1 && g->extent.x2 >= want.x2 &&
+		    g->extent.y1 <= want.y1 && g->extent.y2 >= want.y2 &&
+		    memcmp(g->key, key, key_len * sizeof(*key)) == 0) {
+			/* Move to the head of the LRU list */
+			xorg_list_del(&g->node);
+			xorg_list_add(&g->node, &etnaviv->gradient_lru);
+			goto found;
+		}
+	}
+
+	size = (size_t)box_width(&want) * box_height(&want) * 4;
+	if (size > GRADIENT_MAX_SIZE)
+		return NULL;
+
+	g = malloc(sizeof(*g) + key_len * sizeof(*key));
+	if (!g)
+		return NULL;
+
+	g->pixmap = pScreen->CreatePixmap(pScreen, box_width(&want),
+					  box_height(&want), 32,
+					  CREATE_PIXMAP_USAGE_GPU);
+	if (!g->pixmap) {
+		free(g);
+		return NULL;
+	}
+
+	vPix = etnaviv_get_pixmap_priv(g->pixmap);
+	if (!vPix ||
+	    !etnaviv_composite_to_pixmap(PictOpSrc, pict, NULL, g->pixmap,
+					 want.x1, want.y1, 0, 0,
+					 box_width(&want), box_height(&want))) {
+		pScreen->DestroyPixmap(g->pixmap);
+		free(g);
+		return NULL;
+	}
+
+	g->extent = want;
+	g->size = size;
+	g->hash = hash;
+	g->key_len = key_len;
+	memcpy(g->key, key, key_len * sizeof(*key));
+
+	xorg_list_add(&g->node, &etnaviv->gradient_lru);
+	etnaviv->gradient_size += size;
+
+	/* Evict the least recently used gradients to stay within budget */
+	while (etnaviv->gradient_size > GRADIENT_CACHE_BUDGET)
+		etnaviv_gradient_free(pScreen,
+			xorg_list_last_entry(&etnaviv->gradient_lru,
+					     struct etnaviv_gradient, node));
+
+ found:
+	vPix = etnaviv_get_pixmap_priv(g->pixmap);
+	vPix->pict_format = etnaviv_pict_format(PICT_a8r8g8b8);
+
+	src_topleft->x -= g->extent.x1;
+	src_topleft->y -= g->extent.y1;
+
+	return vPix;
+}
+
 /*
  * There is a bug in the GPU hardware with destinations lacking alpha and
  * swizzles BGRA/RGBA.  Rather than the GPU treating bits 7:0 as alpha, it
@@ -465,8 +717,10 @@ static struct etnaviv_pixmap *etnaviv_acquire_drawable_picture(
 		struct pixman_transform inv;
 		struct pixman_vector vec;
 
-		if (!picture_transform(pict, &prop))
+		if (!picture_transform(pict, &prop)) {
+			etnaviv_fallback(etnaviv, FB_TRANSFORM);
 			return NULL;
+		}
 
 		if (rotation) {
 			switch (prop.rot_mode) {
@@ -516,6 +770,385 @@ static struct etnaviv_pixmap *etnaviv_acquire_drawable_picture(
 	return vpix;
 }
 
+/*
+ * Acquire a drawable picture with a scaling transform, using the VR
+ * filter blit engine to scale the source into the temporary pixmap.
+ * The transform may only scale and translate; anything else (and the
+ * convolution filter) is left to the fallback path.  Scaling in both
+ * directions is performed as a vertical pass into an intermediate
+ * pixmap followed by a horizontal pass, as for Xv.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_scaled(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *src_topleft)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	PictTransformPtr t = pict->transform;
+	DrawablePtr drawable = pict->pDrawable;
+	struct etnaviv_pixmap *vSrc, *vTemp, *vMid;
+	struct etnaviv_vr_op op;
+	enum etnaviv_filter filter;
+	PixmapPtr pMid = NULL;
+	BoxRec bounds, box;
+	xPoint offset;
+	Bool scale_x, scale_y;
+	int64_t u, v;
+	int x1, x2;
+
+	if (!drawable || !t)
+		return NULL;
+
+	if (t->matrix[0][1] != 0 || t->matrix[1][0] != 0 ||
+	    t->matrix[2][0] != 0 || t->matrix[2][1] != 0 ||
+	    t->matrix[2][2] != pixman_fixed_1 ||
+	    t->matrix[0][0] <= 0 || t->matrix[1][1] <= 0)
+		return NULL;
+
+	switch (pict->filter) {
+	case PictFilterNearest:
+	case PictFilterFast:
+		filter = ETNAVIV_FILTER_NEAREST;
+		break;
+	case PictFilterBilinear:
+	case PictFilterGood:
+	case PictFilterBest:
+		filter = ETNAVIV_FILTER_BILINEAR;
+		break;
+	default:
+		return NULL;
+	}
+
+	vSrc = etnaviv_drawable_offset(drawable, &offset);
+	if (!vSrc)
+		return NULL;
+
+	offset.x += drawable->x;
+	offset.y += drawable->y;
+
+	etnaviv_set_format(vSrc, pict);
+	if (!etnaviv_src_format_valid(etnaviv, vSrc->pict_format))
+		return NULL;
+
+	if (!picture_has_pixels(pict, *src_topleft, clip))
+		return NULL;
+
+	/*
+	 * The 16.16 position on the source pixmap of the top left corner
+	 * of the clip box, and the source drawable bounds on the pixmap.
+	 */
+	u = (int64_t)t->matrix[0][0] * (src_topleft->x + clip->x1) +
+	    t->matrix[0][2] + pixman_int_to_fixed(offset.x);
+	v = (int64_t)t->matrix[1][1] * (src_topleft->y + clip->y1) +
+	    t->matrix[1][2] + pixman_int_to_fixed(offset.y);
+	if (u < 0 || v < 0)
+		return NULL;
+
+	/*
+	 * pixman samples at the centre of each destination pixel, which
+	 * lies half a destination pixel further into the source, less
+	 * the half pixel to the centre of the source pixel.  When
+	 * upscaling, this may start before the source edge; the filter
+	 * clamps to the source bounds, so start at the edge.
+	 */
+	u += t->matrix[0][0] / 2 - pixman_fixed_1 / 2;
+	v += t->matrix[1][1] / 2 - pixman_fixed_1 / 2;
+	if (u < 0)
+		u = 0;
+	if (v < 0)
+		v = 0;
+	if (u > INT32_MAX || v > INT32_MAX)
+		return NULL;
+
+	box_init(&bounds, offset.x, offset.y,
+		 drawable->width, drawable->height);
+
+	/* A pass is not required for an axis which is only translated */
+	scale_x = t->matrix[0][0] != pixman_fixed_1 || pixman_fixed_frac(u);
+	scale_y = t->matrix[1][1] != pixman_fixed_1 || pixman_fixed_frac(v);
+	if (!scale_x && !scale_y)
+		return NULL;
+
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	if (!etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW))
+		return NULL;
+
+	op.src = INIT_BLIT_PIX(vSrc, vSrc->pict_format, ZERO_OFFSET);
+	op.src_pitches = op.src_offsets = NULL;
+	op.src_bounds = bounds;
+
+	/* RENDER filters are point sampled, so use the 1:1 kernel */
+	etnaviv_filter_load(etnaviv, filter, pixman_fixed_1);
+
+	if (scale_y) {
+		uint32_t x;
+
+		if (scale_x) {
+			/*
+			 * Only the source columns which the horizontal
+			 * pass samples (including the filter taps) need
+			 * to be scaled into the intermediate pixmap.
+			 */
+			x1 = max_t(int, bounds.x1, (u >> 16) - 4);
+			x2 = min_t(int, bounds.x2,
+				   ((u + (int64_t)t->matrix[0][0] *
+				     box_width(clip)) >> 16) + 5);
+			if (x2 <= x1)
+				return NULL;
+
+			pMid = pScreen->CreatePixmap(pScreen, x2 - x1,
+						     box_height(clip), 32,
+						     CREATE_PIXMAP_USAGE_GPU);
+			if (!pMid)
+				return NULL;
+
+			vMid = etnaviv_get_pixmap_priv(pMid);
+			vMid->pict_format = etnaviv_pict_format(PICT_a8r8g8b8);
+			if (!etnaviv_map_gpu(etnaviv, vMid, GPU_ACCESS_RW))
+				goto destroy;
+
+			op.dst = INIT_BLIT_PIX(vMid, vMid->pict_format,
+					       ZERO_OFFSET);
+			box_init(&box, 0, 0, x2 - x1, box_height(clip));
+			x = pixman_int_to_fixed(x1);
+		} else {
+			op.dst = INIT_BLIT_PIX(vTemp, vTemp->pict_format,
+					       ZERO_OFFSET);
+			box = *clip;
+			x = u;
+		}
+
+		op.h_scale = pixman_fixed_1;
+		op.v_scale = t->matrix[1][1];
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
+
+		etnaviv_batch_add(etnaviv, op.src.pixmap);
+		etnaviv_batch_add(etnaviv, op.dst.pixmap);
+		etnaviv_vr_op(etnaviv, &op, &box, x, v, &box, 1);
+
+		if (scale_x) {
+			/* The intermediate is the source for the next pass */
+			op.src = op.dst;
+			op.src_bounds = box;
+			u -= pixman_int_to_fixed(x1);
+			v = 0;
+		}
+	}
+
+	if (scale_x) {
+		op.dst = INIT_BLIT_PIX(vTemp, vTemp->pict_format, ZERO_OFFSET);
+		op.h_scale = t->matrix[0][0];
+		op.v_scale = pixman_fixed_1;
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+
+		etnaviv_batch_add(etnaviv, op.src.pixmap);
+		etnaviv_batch_add(etnaviv, op.dst.pixmap);
+		etnaviv_vr_op(etnaviv, &op, clip, u, v, clip, 1);
+	}
+
+	/*
+	 * The scaled image must be opaque if the source has no alpha:
+	 * the filter blit leaves the unused alpha bits as they were.
+	 */
+	if (!PICT_FORMAT_A(pict->format)) {
+		struct etnaviv_de_op fill = {
+			.clip = clip,
+			.rop = 0xfa,
+			.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
+			.brush = TRUE,
+			.fg_colour = 0xff000000,
+		};
+
+		fill.dst = INIT_BLIT_PIX(vTemp, vTemp->pict_format,
+					 ZERO_OFFSET);
+
+		etnaviv_batch_start(etnaviv, &fill);
+		etnaviv_de_op(etnaviv, &fill, clip, 1);
+		etnaviv_de_end(etnaviv);
+	}
+
+	if (pMid)
+		pScreen->DestroyPixmap(pMid);
+
+	src_topleft->x = 0;
+	src_topleft->y = 0;
+
+	return vTemp;
+
+destroy:
+	pScreen->DestroyPixmap(pMid);
+	return NULL;
+}
+
+static void etnaviv_copy_box(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, const BoxRec *box, xPoint origin)
+{
+	op->clip = box;
+	etnaviv_batch_start(etnaviv, op);
+	etnaviv_de_op_src_origin(etnaviv, op, origin, box);
+	etnaviv_de_end(etnaviv);
+}
+
+/*
+ * RepeatPad: copy the part of the clip box covered by the source (or
+ * the nearest row or column of it) and then extend its edges outwards
+ * by repeatedly doubling the extended area.  Each copy reads the result
+ * of the previous one, so each must be a separate batch.
+ */
+static void etnaviv_repeat_pad(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, struct etnaviv_pixmap *vTemp,
+	const BoxRec *clip, xPoint src, int w, int h)
+{
+	xPoint origin;
+	BoxRec in, box;
+	int pos, n;
+
+	in.x1 = min_t(int, max_t(int, -src.x, clip->x1), clip->x2 - 1);
+	in.x2 = min_t(int, max_t(int, w - src.x, in.x1 + 1), clip->x2);
+	in.y1 = min_t(int, max_t(int, -src.y, clip->y1), clip->y2 - 1);
+	in.y2 = min_t(int, max_t(int, h - src.y, in.y1 + 1), clip->y2);
+	origin.x = min_t(int, max_t(int, src.x + in.x1, 0), w - 1);
+	origin.y = min_t(int, max_t(int, src.y + in.y1, 0), h - 1);
+
+	etnaviv_copy_box(etnaviv, op, &in, origin);
+
+	op->src = INIT_BLIT_PIX(vTemp, vTemp->pict_format, ZERO_OFFSET);
+	op->blend_op = NULL;
+
+	for (pos = in.x1; pos > clip->x1; pos -= n) {
+		n = min_t(int, in.x1 + 1 - pos, pos - clip->x1);
+		box_init(&box, pos - n, in.y1, n, in.y2 - in.y1);
+		origin.x = pos;
+		origin.y = in.y1;
+		etnaviv_copy_box(etnaviv, op, &box, origin);
+	}
+	for (pos = in.x2; pos < clip->x2; pos += n) {
+		n = min_t(int, pos - in.x2 + 1, clip->x2 - pos);
+		box_init(&box, pos, in.y1, n, in.y2 - in.y1);
+		origin.x = pos - n;
+		origin.y = in.y1;
+		etnaviv_copy_box(etnaviv, op, &box, origin);
+	}
+	for (pos = in.y1; pos > clip->y1; pos -= n) {
+		n = min_t(int, in.y1 + 1 - pos, pos - clip->y1);
+		box_init(&box, clip->x1, pos - n, box_width(clip), n);
+		origin.x = clip->x1;
+		origin.y = pos;
+		etnaviv_copy_box(etnaviv, op, &box, origin);
+	}
+	for (pos = in.y2; pos < clip->y2; pos += n) {
+		n = min_t(int, pos - in.y2 + 1, clip->y2 - pos);
+		box_init(&box, clip->x1, pos, box_width(clip), n);
+		origin.x = clip->x1;
+		origin.y = pos - n;
+		etnaviv_copy_box(etnaviv, op, &box, origin);
+	}
+}
+
+/*
+ * Acquire a repeating pixmap picture which does not cover the clip
+ * box, by expanding it into the temporary pixmap on the GPU.  Normal
+ * and reflected repeats are tiled from a pattern which is cached with
+ * the source pixmap, and rebuilt when the pixmap is written.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_repeat(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *src_topleft)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	DrawablePtr drawable = pict->pDrawable;
+	struct etnaviv_pixmap *vSrc, *vPat, *vTemp;
+	struct etnaviv_blend_op copy_op;
+	struct etnaviv_de_op op;
+	PixmapPtr pPix, pPat;
+	xPoint tile_off;
+
+	if (!drawable || drawable->type != DRAWABLE_PIXMAP ||
+	    !drawable->width || !drawable->height ||
+	    !pict->repeat || pict->transform)
+		return NULL;
+
+	pPix = (PixmapPtr)drawable;
+	vSrc = etnaviv_get_pixmap_priv(pPix);
+	if (!vSrc)
+		return NULL;
+
+	etnaviv_set_format(vSrc, pict);
+	if (!etnaviv_src_format_valid(etnaviv, vSrc->pict_format))
+		return NULL;
+
+	switch (pict->repeatType) {
+	case RepeatNormal:
+		/* Large or unreplicable tiles are used directly */
+		pPat = etnaviv_tile_pattern(etnaviv, pPix);
+		if (!pPat)
+			pPat = pPix;
+		break;
+	case RepeatReflect:
+		pPat = etnaviv_reflect_pattern(etnaviv, pPix);
+		if (!pPat)
+			return NULL;
+		break;
+	case RepeatPad:
+		pPat = pPix;
+		break;
+	default:
+		return NULL;
+	}
+
+	vPat = etnaviv_get_pixmap_priv(pPat);
+	etnaviv_set_format(vPat, pict);
+
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	if (!etnaviv_map_gpu(etnaviv, vPat, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW))
+		return NULL;
+
+	copy_op = etnaviv_composite_op[PictOpSrc];
+
+	if (etnaviv_workaround_nonalpha(&vPat->pict_format)) {
+		copy_op.alpha_mode |= VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_GLOBAL;
+		copy_op.src_alpha = 255;
+	}
+
+	op.dst = INIT_BLIT_PIX(vTemp, vTemp->pict_format, ZERO_OFFSET);
+	op.src = INIT_BLIT_PIX(vPat, vPat->pict_format, ZERO_OFFSET);
+	op.blend_op = &copy_op;
+	op.clip = clip;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+
+	if (pict->repeatType == RepeatPad) {
+		etnaviv_repeat_pad(etnaviv, &op, vTemp, clip, *src_topleft,
+				   drawable->width, drawable->height);
+	} else {
+		tile_off.x = -src_topleft->x;
+		tile_off.y = -src_topleft->y;
+
+		etnaviv_batch_start(etnaviv, &op);
+		etnaviv_de_op_tiled(etnaviv, &op, clip, pPat->drawable.width,
+				    pPat->drawable.height, tile_off);
+		etnaviv_de_end(etnaviv);
+	}
+
+	src_topleft->x = 0;
+	src_topleft->y = 0;
+
+	return vTemp;
+}
+
 /*
  * Acquire the source. If we're filling a solid surface, force it to have
  * alpha; it may be used in combination with a mask.  Otherwise, we ask
@@ -550,10 +1183,37 @@ static struct etnaviv_pixmap *etnaviv_acquire_src(ScreenPtr pScreen,
 		return vTemp;
 	}
 
+	if (!pict->pDrawable) {
+		vSrc = etnaviv_acquire_gradient(pScreen, pict, clip,
+						src_topleft);
+		if (!vSrc)
+			goto fallback;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		if (force_vtemp)
+			goto copy_to_vtemp;
+
+		return vSrc;
+	}
+
 	vSrc = etnaviv_acquire_drawable_picture(pScreen, pict, clip,
 						src_topleft, rotation);
-	if (!vSrc)
-		goto fallback;
+	if (!vSrc) {
+		vTemp = etnaviv_acquire_scaled(pScreen, pict, clip,
+					       ppPixTemp, src_topleft);
+		if (!vTemp)
+			vTemp = etnaviv_acquire_repeat(pScreen, pict, clip,
+						       ppPixTemp, src_topleft);
+		if (!vTemp)
+			goto fallback;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		return vTemp;
+	}
 
 	if (force_vtemp)
 		goto copy_to_vtemp;
@@ -665,13 +1325,33 @@ static int etnaviv_accel_composite_srconly(PicturePtr pSrc, PicturePtr pDst,
 	BoxRec clip_temp;
 	xPoint src_topleft;
 	unsigned rotation;
+	uint32_t colour;
 
 	if (pSrc->alphaMap)
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_ALPHA_MAP);
 
-	/* If the source has no drawable, and is not solid, fallback */
-	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL))
-		return FALSE;
+	/*
+	 * On PE2.0, a solid source is a single pixel which a stretch blit
+	 * replicates over the destination, rather than a temporary pixmap
+	 * filled with the colour.
+	 */
+	if (VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20) &&
+	    etnaviv_pict_solid_argb(pSrc, &colour)) {
+		vSrc = etnaviv_solid_src(pScreen, colour, &src_topleft);
+		if (!vSrc)
+			return FALSE;
+
+		if (!etnaviv_map_gpu(etnaviv, state->dst.pix, GPU_ACCESS_RW) ||
+		    !etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO))
+			return FALSE;
+
+		state->final_op.src = INIT_BLIT_PIX(vSrc, vSrc->pict_format,
+						    src_topleft);
+		state->final_op.src_origin_mode = SRC_ORIGIN_NONE;
+		state->final_op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT;
+
+		return TRUE;
+	}
 
 	src_topleft.x = xSrc;
 	src_topleft.y = ySrc;
@@ -760,15 +1440,11 @@ static int etnaviv_accel_composite_masked(PicturePtr pSrc, PicturePtr pMask,
 	vTemp = etnaviv_get_scratch_argb(pScreen, &state->pPixTemp,
 					 clip_temp.x2, clip_temp.y2);
 	if (!vTemp)
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_NO_MEMORY);
 
 	if (pSrc->alphaMap || pMask->alphaMap)
 		goto fallback;
 
-	/* If the source has no drawable, and is not solid, fallback */
-	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL))
-		goto fallback;
-
 	mask_op = etnaviv_composite_op[PictOpInReverse];
 
 	if (pMask->componentAlpha && PICT_FORMAT_RGB(pMask->format)) {
@@ -1021,52 +1697,102 @@ static Bool etnaviv_accel_reduce_mask(struct etnaviv_composite_state *state,
  * function below.  The source for this operation is determined by
  * sub-functions.
  */
-static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
-	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
-	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
+static Bool etnaviv_blit_buf_equal(const struct etnaviv_blit_buf *a,
+	const struct etnaviv_blit_buf *b)
 {
-	ScreenPtr pScreen = pDst->pDrawable->pScreen;
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
-	struct etnaviv_composite_state state;
-	int rc;
+	return a->pixmap == b->pixmap && a->bo == b->bo &&
+	       a->format.format == b->format.format &&
+	       a->format.swizzle == b->format.swizzle &&
+	       a->format.tile == b->format.tile &&
+	       a->offset.x == b->offset.x && a->offset.y == b->offset.y &&
+	       a->rotate == b->rotate;
+}
 
-#ifdef DEBUG_BLEND
-	etnaviv_debug_blend_op(__FUNCTION__, op, width, height,
-			       pSrc, xSrc, ySrc,
-			       pMask, xMask, yMask,
-			       pDst, xDst, yDst);
-	state.op = op;
-#endif
-	state.pPixTemp = NULL;
+static Bool etnaviv_blend_op_equal(const struct etnaviv_blend_op *a,
+	const struct etnaviv_blend_op *b)
+{
+	return a->alpha_mode == b->alpha_mode &&
+	       a->src_mode == b->src_mode && a->dst_mode == b->dst_mode &&
+	       a->src_alpha == b->src_alpha && a->dst_alpha == b->dst_alpha &&
+	       a->src_colour == b->src_colour &&
+	       a->colour_mode == b->colour_mode;
+}
 
+/*
+ * Emit the final composite operation.  Runs of composites with the
+ * same source, destination and blend are common, so the batch is left
+ * open for a following identical composite to add its boxes to.  The
+ * boxes have already been clipped, so the batch is clipped only to the
+ * destination pixmap, which any of the composites can share.
+ */
+static void etnaviv_composite_emit(struct etnaviv *etnaviv,
+	struct etnaviv_composite_state *state)
+{
+	struct etnaviv_de_op *op = &state->final_op;
+	struct etnaviv_de_op *open = &etnaviv->composite_op;
+
+	if (etnaviv->batch_open &&
+	    etnaviv_blit_buf_equal(&open->dst, &op->dst) &&
+	    etnaviv_blit_buf_equal(&open->src, &op->src) &&
+	    etnaviv_blend_op_equal(&etnaviv->composite_blend,
+				   op->blend_op) &&
+	    open->src_origin_mode == op->src_origin_mode &&
+	    open->cmd == op->cmd) {
+		etnaviv_de_op(etnaviv, open, RegionRects(&state->region),
+			      RegionNumRects(&state->region));
+		return;
+	}
+
+	box_init(&etnaviv->composite_clip, -op->dst.offset.x,
+		 -op->dst.offset.y, state->dst.pix->width,
+		 state->dst.pix->height);
+	etnaviv->composite_blend = *op->blend_op;
+
+	*open = *op;
+	open->clip = &etnaviv->composite_clip;
+	open->blend_op = &etnaviv->composite_blend;
+
+	etnaviv_batch_start(etnaviv, open);
+	etnaviv_de_op(etnaviv, open, RegionRects(&state->region),
+		      RegionNumRects(&state->region));
+	etnaviv->batch_open = TRUE;
+}
+
+/*
+ * Set up the destination of a composite operation, and the final blend
+ * for the operation, adjusted for the destination format.
+ */
+static Bool etnaviv_composite_dst_init(struct etnaviv *etnaviv,
+	struct etnaviv_composite_state *state, CARD8 op, PicturePtr pDst)
+{
 	/* If the destination has an alpha map, fallback */
 	if (pDst->alphaMap)
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_ALPHA_MAP);
 
 	/* If we can't do the op, there's no point going any further */
 	if (op >= ARRAY_SIZE(etnaviv_composite_op))
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_OPERATOR);
 
 	/* The destination pixmap must have a bo */
-	state.dst.pix = etnaviv_drawable_offset(pDst->pDrawable,
-						&state.dst.offset);
-	if (!state.dst.pix)
-		return FALSE;
+	state->dst.pix = etnaviv_drawable_offset(pDst->pDrawable,
+						 &state->dst.offset);
+	if (!state->dst.pix)
+		return etnaviv_fallback(etnaviv, FB_NO_GPU);
 
-	state.dst.format = etnaviv_set_format(state.dst.pix, pDst);
+	state->dst.format = etnaviv_set_format(state->dst.pix, pDst);
 
 	/* ... and the destination format must be supported */
-	if (!etnaviv_dst_format_valid(etnaviv, state.dst.format))
-		return FALSE;
+	if (!etnaviv_dst_format_valid(etnaviv, state->dst.format))
+		return etnaviv_fallback(etnaviv, FB_FORMAT);
 
-	state.final_blend = etnaviv_composite_op[op];
+	state->final_blend = etnaviv_composite_op[op];
 
 	/*
 	 * Apply the workaround for non-alpha destination.  The test order
 	 * is important here: we only need the full workaround for non-
 	 * PictOpClear operations, but we still need the format adjustment.
 	 */
-	if (etnaviv_workaround_nonalpha(&state.dst.format) &&
+	if (etnaviv_workaround_nonalpha(&state->dst.format) &&
 	    op != PictOpClear) {
 		/*
 		 * When the destination does not have an alpha channel, we
@@ -1075,12 +1801,12 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		 * on destination alpha with their corresponding constant
 		 * value modes, rather than using global alpha subsitution.
 		 */
-		switch (state.final_blend.src_mode) {
+		switch (state->final_blend.src_mode) {
 		case DE_BLENDMODE_NORMAL:
-			state.final_blend.src_mode = DE_BLENDMODE_ONE;
+			state->final_blend.src_mode = DE_BLENDMODE_ONE;
 			break;
 		case DE_BLENDMODE_INVERSED:
-			state.final_blend.src_mode = DE_BLENDMODE_ZERO;
+			state->final_blend.src_mode = DE_BLENDMODE_ZERO;
 			break;
 		}
 
@@ -1093,11 +1819,35 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		 * A4R4G4B4 limits src.A to the top four bits.
 		 */
 		if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20) &&
-		    state.dst.format.format != DE_FORMAT_A8R8G8B8 &&
-		    etnaviv_op_uses_source_alpha(&state.final_blend))
-			return FALSE;
+		    state->dst.format.format != DE_FORMAT_A8R8G8B8 &&
+		    etnaviv_op_uses_source_alpha(&state->final_blend))
+			return etnaviv_fallback(etnaviv, FB_PE10);
 	}
 
+	return TRUE;
+}
+
+static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
+	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_composite_state state;
+	int rc;
+
+#ifdef DEBUG_BLEND
+	etnaviv_debug_blend_op(__FUNCTION__, op, width, height,
+			       pSrc, xSrc, ySrc,
+			       pMask, xMask, yMask,
+			       pDst, xDst, yDst);
+	state.op = op;
+#endif
+	state.pPixTemp = NULL;
+
+	if (!etnaviv_composite_dst_init(etnaviv, &state, op, pDst))
+		return FALSE;
+
 	/*
 	 * Compute the composite region from the source, mask and
 	 * destination positions on their backing pixmaps.  The
@@ -1112,6 +1862,9 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	if (pMask)
 		miCompositeSourceValidate(pMask);
 
+	state.final_op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	state.final_op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
 	if (op == PictOpClear) {
 		/* Short-circuit for PictOpClear */
 		rc = etnaviv_Composite_Clear(pDst, &state);
@@ -1138,11 +1891,8 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		state.final_op.dst = INIT_BLIT_PIX(state.dst.pix,
 						   state.dst.format,
 						   state.dst.offset);
-		state.final_op.clip = RegionExtents(&state.region);
 		state.final_op.blend_op = &state.final_blend;
-		state.final_op.src_origin_mode = SRC_ORIGIN_RELATIVE;
 		state.final_op.rop = 0xcc;
-		state.final_op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 		state.final_op.brush = FALSE;
 
 #ifdef DEBUG_BLEND
@@ -1153,11 +1903,7 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 			  "A-FDST%2.2x-%p", op, pDst);
 #endif
 
-		etnaviv_batch_start(etnaviv, &state.final_op);
-		etnaviv_de_op(etnaviv, &state.final_op,
-			      RegionRects(&state.region),
-			      RegionNumRects(&state.region));
-		etnaviv_de_end(etnaviv);
+		etnaviv_composite_emit(etnaviv, &state);
 
 #ifdef DEBUG_BLEND
 		etnaviv_batch_wait_commit(etnaviv, state.final_op.dst.pixmap);
@@ -1176,6 +1922,309 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	return rc;
 }
 
+/*
+ * Fill a set of rectangles with a solid colour.  All the rectangles
+ * are blended with a single stretch blit operation from a one pixel
+ * source, which needs PE2.0.
+ */
+static Bool etnaviv_accel_CompositeRects(CARD8 op, PicturePtr pDst,
+	xRenderColor *color, int nRect, xRectangle *rects)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_composite_state state;
+	struct etnaviv_pixmap *vSrc;
+	xPoint src_topleft;
+	RegionPtr rgn;
+	Bool ret;
+
+	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20))
+		return etnaviv_fallback(etnaviv, FB_PE10);
+
+#ifdef DEBUG_BLEND
+	state.op = op;
+#endif
+	if (!etnaviv_composite_dst_init(etnaviv, &state, op, pDst))
+		return FALSE;
+
+	rgn = RegionFromRects(nRect, rects, CT_UNSORTED);
+	if (!rgn)
+		return FALSE;
+
+	RegionTranslate(rgn, pDst->pDrawable->x, pDst->pDrawable->y);
+	RegionNull(&state.region);
+	ret = RegionIntersect(&state.region, rgn, pDst->pCompositeClip);
+	RegionDestroy(rgn);
+
+	if (!ret || !RegionNotEmpty(&state.region))
+		goto out;
+
+	vSrc = etnaviv_solid_src(pScreen, etnaviv_render_colour_argb(color),
+				 &src_topleft);
+	if (!vSrc ||
+	    !etnaviv_map_gpu(etnaviv, state.dst.pix, GPU_ACCESS_RW) ||
+	    !etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO)) {
+		ret = FALSE;
+		goto out;
+	}
+
+	state.final_op.dst = INIT_BLIT_PIX(state.dst.pix, state.dst.format,
+					   state.dst.offset);
+	state.final_op.src = INIT_BLIT_PIX(vSrc, vSrc->pict_format,
+					   src_topleft);
+	state.final_op.blend_op = &state.final_blend;
+	state.final_op.src_origin_mode = SRC_ORIGIN_NONE;
+	state.final_op.rop = 0xcc;
+	state.final_op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT;
+	state.final_op.brush = FALSE;
+
+	etnaviv_composite_emit(etnaviv, &state);
+
+ out:
+	RegionUninit(&state.region);
+
+	return ret;
+}
+
+/*
+ * Without a mask format, each glyph is composited individually.  When
+ * none of the glyphs overlap, this is the same as compositing through
+ * a mask of all the glyphs, clipped to the glyph boxes.  Compute this
+ * clip region, failing if any of the glyph boxes intersect.  The
+ * region must be released by the caller, even on failure.
+ */
+static Bool etnaviv_glyphs_region(RegionPtr region,
+	const struct glyph_render *gr, int n)
+{
+	const BoxRec *pBox;
+	BoxPtr boxes;
+	long area = 0;
+	int i;
+
+	boxes = malloc(sizeof(*boxes) * n);
+	if (!boxes)
+		return FALSE;
+
+	for (i = 0; i < n; i++) {
+		boxes[i] = gr[i].dest_box;
+		area += (boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1);
+	}
+
+	i = RegionInitBoxes(region, boxes, n);
+	free(boxes);
+	if (!i)
+		return FALSE;
+
+	/* Overlapping boxes were merged, so the area will be smaller */
+	pBox = RegionRects(region);
+	for (i = RegionNumRects(region); i; i--, pBox++)
+		area -= (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1);
+
+	return area == 0;
+}
+
+/*
+ * Draw a glyph box, clipped to the composite clip.  The source origin
+ * is that of the glyph's top left corner.
+ */
+static void etnaviv_glyph_op(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, RegionPtr clip, xPoint src_origin,
+	const BoxRec *dest)
+{
+	const BoxRec *pBox;
+	int i;
+
+	switch (RegionContainsRect(clip, (BoxPtr)dest)) {
+	case rgnOUT:
+		return;
+
+	case rgnIN:
+		etnaviv_de_op_src_origin(etnaviv, op, src_origin, dest);
+		return;
+	}
+
+	pBox = RegionRects(clip);
+	for (i = RegionNumRects(clip); i; i--, pBox++) {
+		xPoint origin;
+		BoxRec box;
+
+		if (pBox->y1 >= dest->y2)
+			break;
+
+		box.x1 = maxt(pBox->x1, dest->x1);
+		box.y1 = maxt(pBox->y1, dest->y1);
+		box.x2 = mint(pBox->x2, dest->x2);
+		box.y2 = mint(pBox->y2, dest->y2);
+		if (box.x1 >= box.x2 || box.y1 >= box.y2)
+			continue;
+
+		origin.x = src_origin.x + box.x1 - dest->x1;
+		origin.y = src_origin.y + box.y1 - dest->y1;
+		etnaviv_de_op_src_origin(etnaviv, op, origin, &box);
+	}
+}
+
+/*
+ * Component alpha text with a solid source on PE2.0.  Rather than
+ * building a mask and then a temporary (source IN mask), the glyphs
+ * are drawn directly from the cache using two passes:
+ *
+ *  OutReverse: dst.C = dst.C * (1 - src.A * mask.C)
+ *  Add:        dst.C = dst.C + src.C * mask.C
+ *
+ * which together give PictOpOver.  The products with the source are
+ * formed by multiplying the glyph by the global source colour, which
+ * leaves the glyph alpha unscaled, so a translucent source is only
+ * handled when the destination has no alpha channel.  For
+ * PictOpAdd, only the second pass is required.  This is only valid
+ * when the glyphs do not overlap, as the glyphs would otherwise have
+ * been summed in the mask.
+ */
+static Bool etnaviv_accel_glyphs_ca(CARD8 final_op, PicturePtr pSrc,
+	PicturePtr pDst, PictFormatPtr maskFormat, const BoxRec *extents,
+	const struct glyph_render *gr, int n)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_composite_state state;
+	struct etnaviv_blend_op blend[2];
+	const struct glyph_render *grp;
+	struct etnaviv_de_op op;
+	unsigned pass, npass;
+	RegionRec region;
+	PicturePtr pCurrent;
+	uint32_t colour, alpha;
+	BoxRec clip;
+	Bool ret;
+	int dx, dy;
+
+	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20) ||
+	    maskFormat->format != PICT_a8r8g8b8 ||
+	    (final_op != PictOpOver && final_op != PictOpAdd) ||
+	    pSrc->alphaMap || !etnaviv_pict_solid_argb(pSrc, &colour))
+		return FALSE;
+
+	/*
+	 * The global colour only scales the colour channels, so both
+	 * passes blend with the glyph's own alpha.  The destination
+	 * alpha is only correct when the source is opaque.
+	 */
+	if (colour >> 24 != 0xff && PICT_FORMAT_A(pDst->format))
+		return FALSE;
+
+	for (grp = gr; grp < gr + n; grp++)
+		if (grp->picture->format != PICT_a8r8g8b8)
+			return FALSE;
+
+	if (!etnaviv_composite_dst_init(etnaviv, &state, final_op, pDst))
+		return FALSE;
+
+	RegionNull(&region);
+	ret = etnaviv_glyphs_region(&region, gr, n);
+	RegionUninit(&region);
+	if (!ret)
+		return FALSE;
+
+	if (!etnaviv_map_gpu(etnaviv, state.dst.pix, GPU_ACCESS_RW))
+		return FALSE;
+
+	for (grp = gr, pCurrent = NULL; grp < gr + n; grp++) {
+		if (pCurrent != grp->picture) {
+			PixmapPtr pPix = drawable_pixmap(grp->picture->pDrawable);
+
+			if (!etnaviv_map_gpu(etnaviv,
+					     etnaviv_get_pixmap_priv(pPix),
+					     GPU_ACCESS_RO))
+				return FALSE;
+
+			pCurrent = grp->picture;
+		}
+	}
+
+	alpha = colour >> 24;
+
+	npass = 0;
+	if (final_op == PictOpOver) {
+		blend[npass].alpha_mode =
+			VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_NORMAL |
+			VIVS_DE_ALPHA_MODES_GLOBAL_DST_ALPHA_MODE_NORMAL;
+		blend[npass].src_mode = DE_BLENDMODE_ZERO;
+		blend[npass].dst_mode = DE_BLENDMODE_COLOR_INVERSED;
+		blend[npass].src_alpha = alpha;
+		blend[npass].dst_alpha = 0;
+		blend[npass].src_colour = alpha * 0x010101;
+		npass++;
+	}
+	blend[npass].alpha_mode =
+		VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_NORMAL |
+		VIVS_DE_ALPHA_MODES_GLOBAL_DST_ALPHA_MODE_NORMAL;
+	blend[npass].src_mode = DE_BLENDMODE_ONE;
+	blend[npass].dst_mode = DE_BLENDMODE_ONE;
+	blend[npass].src_alpha = alpha;
+	blend[npass].dst_alpha = 0;
+	blend[npass].src_colour = colour & 0xffffff;
+	npass++;
+
+	for (pass = 0; pass < npass; pass++)
+		blend[pass].colour_mode =
+			VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_DISABLE |
+			VIVS_DE_COLOR_MULTIPLY_MODES_DST_PREMULTIPLY_DISABLE |
+			VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_COLOR |
+			VIVS_DE_COLOR_MULTIPLY_MODES_DST_DEMULTIPLY_DISABLE;
+
+	/* The glyph boxes are relative to the extents */
+	dx = extents->x1 + pDst->pDrawable->x;
+	dy = extents->y1 + pDst->pDrawable->y;
+
+	box_init(&clip, -state.dst.offset.x, -state.dst.offset.y,
+		 state.dst.pix->width, state.dst.pix->height);
+
+	op.dst = INIT_BLIT_PIX(state.dst.pix, state.dst.format,
+			       state.dst.offset);
+	op.clip = &clip;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+
+	for (pass = 0; pass < npass; pass++) {
+		op.blend_op = &blend[pass];
+
+		pCurrent = NULL;
+		for (grp = gr; grp < gr + n; grp++) {
+			BoxRec box;
+
+			if (pCurrent != grp->picture) {
+				PixmapPtr pPix = drawable_pixmap(grp->picture->pDrawable);
+				struct etnaviv_pixmap *v = etnaviv_get_pixmap_priv(pPix);
+
+				if (pCurrent)
+					etnaviv_de_end(etnaviv);
+
+				op.src = INIT_BLIT_PIX(v, v->pict_format,
+						       ZERO_OFFSET);
+				pCurrent = grp->picture;
+
+				etnaviv_batch_start(etnaviv, &op);
+			}
+
+			box = grp->dest_box;
+			box.x1 += dx;
+			box.y1 += dy;
+			box.x2 += dx;
+			box.y2 += dy;
+
+			etnaviv_glyph_op(etnaviv, &op, pDst->pCompositeClip,
+					 grp->glyph_pos, &box);
+		}
+		if (pCurrent)
+			etnaviv_de_end(etnaviv);
+	}
+
+	return TRUE;
+}
+
 static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
 	int nlist, GlyphListPtr list, GlyphPtr *glyphs)
@@ -1191,24 +2240,50 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	CARD32 alpha;
 	int width, height, x, y, n, error;
 	struct glyph_render *gr, *grp;
+	RegionRec region;
+	Bool clip_glyphs = FALSE;
 
-	if (!maskFormat)
-		return FALSE;
+	if (!maskFormat) {
+		/*
+		 * The glyphs are composited individually.  We can only
+		 * build an intermediate mask if all glyphs share one format.
+		 */
+		maskFormat = list[0].format;
+		for (n = 1; n < nlist; n++)
+			if (list[n].format != maskFormat)
+				return etnaviv_fallback(etnaviv, FB_FORMAT);
+		clip_glyphs = TRUE;
+	}
 
 	n = glyphs_assemble(pScreen, &gr, &extents, nlist, list, glyphs);
 	if (n == -1)
-		return FALSE;
+		return etnaviv_fallback(etnaviv, FB_GLYPH_CACHE);
 	if (n == 0)
 		return TRUE;
 
+	if (!clip_glyphs &&
+	    etnaviv_accel_glyphs_ca(final_op, pSrc, pDst, maskFormat,
+				    &extents, gr, n)) {
+		free(gr);
+		return TRUE;
+	}
+
+	RegionNull(&region);
+	if (clip_glyphs && !etnaviv_glyphs_region(&region, gr, n)) {
+		etnaviv_fallback(etnaviv, FB_OVERLAP);
+		goto destroy_gr;
+	}
+
 	width = extents.x2 - extents.x1;
 	height = extents.y2 - extents.y1;
 
 	pMaskPixmap = pScreen->CreatePixmap(pScreen, width, height,
 					    maskFormat->depth,
 					    CREATE_PIXMAP_USAGE_GPU);
-	if (!pMaskPixmap)
+	if (!pMaskPixmap) {
+		etnaviv_fallback(etnaviv, FB_NO_MEMORY);
 		goto destroy_gr;
+	}
 
 	alpha = NeedsComponent(maskFormat->format);
 	pMask = CreatePicture(0, &pMaskPixmap->drawable, maskFormat,
@@ -1219,6 +2294,11 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	/* Drop our reference to the mask pixmap */
 	pScreen->DestroyPixmap(pMaskPixmap);
 
+	/* Restrict the final composite to the glyph boxes */
+	if (clip_glyphs &&
+	    SetPictureClipRegion(pMask, 0, 0, &region) != Success)
+		goto destroy_picture;
+
 	vMask = etnaviv_get_pixmap_priv(pMaskPixmap);
 	/* Clear the mask to transparent */
 	fmt = etnaviv_set_format(vMask, pMask);
@@ -1280,104 +2360,205 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 			 width, height);
 
 	FreePicture(pMask, 0);
+	RegionUninit(&region);
 	return TRUE;
 
 destroy_picture:
 	FreePicture(pMask, 0);
+	RegionUninit(&region);
 	free(gr);
 	return FALSE;
 
 destroy_pixmap:
 	pScreen->DestroyPixmap(pMaskPixmap);
 destroy_gr:
+	RegionUninit(&region);
 	free(gr);
 	return FALSE;
 }
 
-static void etnaviv_accel_glyph_upload(ScreenPtr pScreen, PicturePtr pDst,
-	GlyphPtr pGlyph, PicturePtr pSrc, unsigned x, unsigned y)
+static void etnaviv_glyph_stage_retire(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+}
+
+/*
+ * Get the next glyph staging buffer, waiting for the GPU to finish
+ * with its previous contents.
+ */
+static struct etnaviv_stage *etnaviv_glyph_stage_get(struct etnaviv *etnaviv)
+{
+	struct etnaviv_stage *stage;
+	unsigned i;
+
+	/* Prefer a buffer which is already idle */
+	for (i = 0; i < ETNAVIV_GLYPH_STAGES; i++) {
+		stage = &etnaviv->glyph_stage[etnaviv->glyph_stage_next];
+		etnaviv->glyph_stage_next = (etnaviv->glyph_stage_next + 1) %
+					    ETNAVIV_GLYPH_STAGES;
+		if (stage->fence.state == B_NONE)
+			break;
+	}
+
+	etnaviv_fence_wait(etnaviv, &stage->fence);
+
+	if (!stage->bo) {
+		stage->bo = etna_bo_new(etnaviv->conn, ETNAVIV_GLYPH_STAGE_SIZE,
+					DRM_ETNA_GEM_TYPE_BMP);
+		if (!stage->bo) {
+			xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+				   "etnaviv: etna_bo_new(size=%u) failed\n",
+				   ETNAVIV_GLYPH_STAGE_SIZE);
+			return NULL;
+		}
+
+		stage->ptr = etna_bo_map(stage->bo);
+		if (!stage->ptr) {
+			etna_bo_del(etnaviv->conn, stage->bo, NULL);
+			stage->bo = NULL;
+			return NULL;
+		}
+
+		stage->fence.retire = etnaviv_glyph_stage_retire;
+	}
+
+	return stage;
+}
+
+static void etnaviv_glyph_stage_fini(struct etnaviv *etnaviv)
+{
+	unsigned i;
+
+	for (i = 0; i < ETNAVIV_GLYPH_STAGES; i++) {
+		struct etnaviv_stage *stage = &etnaviv->glyph_stage[i];
+
+		if (stage->bo) {
+			etnaviv_fence_wait(etnaviv, &stage->fence);
+			etna_bo_del(etnaviv->conn, stage->bo, NULL);
+			stage->bo = NULL;
+			stage->ptr = NULL;
+		}
+	}
+}
+
+/*
+ * Upload a set of glyphs to an atlas page.  Glyphs in system memory
+ * are packed into a staging buffer, one above the other, and copied
+ * to the atlas with one batch per staging buffer.
+ */
+static Bool etnaviv_accel_glyph_upload(ScreenPtr pScreen, PicturePtr pDst,
+	const struct glyph_upload *up, unsigned n)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
-	PixmapPtr src_pix = drawable_pixmap(pSrc->pDrawable);
 	PixmapPtr dst_pix = drawable_pixmap(pDst->pDrawable);
 	struct etnaviv_pixmap *vdst = etnaviv_get_pixmap_priv(dst_pix);
-	struct etnaviv_format fmt;
+	struct etnaviv_stage *stage = NULL;
 	struct etnaviv_de_op op;
-	unsigned width = pGlyph->info.width;
-	unsigned height = pGlyph->info.height;
-	unsigned old_pitch = src_pix->devKind;
-	unsigned i, pitch = ALIGN(old_pitch, 16);
-	struct etna_bo *usr = NULL;
-	BoxRec box;
-	xPoint src_offset, dst_offset = { 0, };
-	struct etnaviv_pixmap *vpix;
-	void *b = NULL;
+	unsigned i, row = 0, rows, pitch = 0;
+	BoxRec clip;
 
-	src_offset.x = -x;
-	src_offset.y = -y;
+	if (!vdst || !etnaviv_map_gpu(etnaviv, vdst, GPU_ACCESS_RW))
+		return FALSE;
 
-	vpix = etnaviv_get_pixmap_priv(src_pix);
-	if (vpix) {
-		fmt = etnaviv_set_format(vpix, pSrc);
-		op.src = INIT_BLIT_PIX(vpix, fmt, src_offset);
-	} else {
-		struct etnaviv_usermem_node *unode;
-		char *buf, *src = src_pix->devPrivate.ptr;
-		size_t size, align = maxt(VIVANTE_ALIGN_MASK, getpagesize());
+	/* The staging pitch must suit the widest system memory glyph */
+	for (i = 0; i < n; i++) {
+		PixmapPtr src_pix = drawable_pixmap(up[i].picture->pDrawable);
 
-		unode = malloc(sizeof(*unode));
-		if (!unode)
-			return;
+		if (!etnaviv_get_pixmap_priv(src_pix) &&
+		    pitch < src_pix->devKind)
+			pitch = src_pix->devKind;
+	}
+	pitch = ALIGN(pitch, 16);
+	rows = pitch ? ETNAVIV_GLYPH_STAGE_SIZE / pitch : 0;
 
-		memset(unode, 0, sizeof(*unode));
+	box_init(&clip, 0, 0, dst_pix->drawable.width,
+		 dst_pix->drawable.height);
 
-		size = pitch * height + align - 1;
-		size &= ~(align - 1);
+	op.dst = INIT_BLIT_PIX(vdst, etnaviv_set_format(vdst, pDst),
+			       ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.clip = &clip;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
 
-		if (posix_memalign(&b, align, size))
-			return;
+	for (i = 0; i < n; i++) {
+		PixmapPtr src_pix = drawable_pixmap(up[i].picture->pDrawable);
+		struct etnaviv_pixmap *vpix = etnaviv_get_pixmap_priv(src_pix);
+		unsigned j, height = up[i].glyph->info.height;
+		struct etnaviv_format fmt;
+		xPoint src_origin;
+		const char *src;
+		char *buf;
+		BoxRec box;
+
+		box_init(&box, up[i].pos.x, up[i].pos.y,
+			 up[i].glyph->info.width, height);
+
+		if (vpix) {
+			if (stage) {
+				etnaviv_de_end(etnaviv);
+				stage = NULL;
+			}
 
-		for (i = 0, buf = b; i < height; i++, buf += pitch)
-			memcpy(buf, src + old_pitch * i, old_pitch);
+			if (!etnaviv_map_gpu(etnaviv, vpix, GPU_ACCESS_RO))
+				return FALSE;
 
-		usr = etna_bo_from_usermem_prot(etnaviv->conn, b, size, PROT_READ);
-		if (!usr) {
-			xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
-				   "etnaviv: %s: etna_bo_from_usermem_prot(ptr=%p, size=%zu) failed: %s\n",
-				   __FUNCTION__, b, size, strerror(errno));
-			free(b);
-			return;
+			fmt = etnaviv_set_format(vpix, up[i].picture);
+			op.src = INIT_BLIT_PIX(vpix, fmt, ZERO_OFFSET);
+
+			src_origin.x = src_origin.y = 0;
+			etnaviv_batch_start(etnaviv, &op);
+			etnaviv_de_op_src_origin(etnaviv, &op, src_origin, &box);
+			etnaviv_de_end(etnaviv);
+			continue;
 		}
 
-		unode->bo = usr;
-		unode->mem = b;
+		if (height > rows)
+			goto fail;
 
-		/* Add this to the list of usermem nodes to be freed */
-		etnaviv_add_freemem(etnaviv, unode);
+		fmt = etnaviv_pict_format(up[i].picture->format);
 
-		op.src = INIT_BLIT_BO(usr, pitch,
-				      etnaviv_pict_format(pSrc->format),
-				      src_offset);
-	}
+		if (stage && (row + height > rows ||
+			      op.src.format.format != fmt.format)) {
+			etnaviv_de_end(etnaviv);
+			stage = NULL;
+		}
 
-	box_init(&box, x, y, width, height);
+		if (!stage) {
+			stage = etnaviv_glyph_stage_get(etnaviv);
+			if (!stage)
+				return FALSE;
 
-	fmt = etnaviv_set_format(vdst, pDst);
+			op.src = INIT_BLIT_BO(stage->bo, pitch, fmt,
+					      ZERO_OFFSET);
+			etnaviv_batch_start(etnaviv, &op);
+			etnaviv_fence_add(&etnaviv->fence_head, &stage->fence);
+			row = 0;
+		}
 
-	if (!etnaviv_map_gpu(etnaviv, vdst, GPU_ACCESS_RW))
-		return;
+		src = src_pix->devPrivate.ptr;
+		buf = (char *)stage->ptr + row * pitch;
+		for (j = 0; j < height; j++, buf += pitch)
+			memcpy(buf, src + src_pix->devKind * j,
+			       src_pix->devKind);
 
-	op.dst = INIT_BLIT_PIX(vdst, fmt, dst_offset);
-	op.blend_op = NULL;
-	op.clip = &box;
-	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
-	op.rop = 0xcc;
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+		src_origin.x = 0;
+		src_origin.y = row;
+		etnaviv_de_op_src_origin(etnaviv, &op, src_origin, &box);
+		row += height;
+	}
 
-	etnaviv_batch_start(etnaviv, &op);
-	etnaviv_de_op(etnaviv, &op, &box, 1);
-	etnaviv_de_end(etnaviv);
+	if (stage)
+		etnaviv_de_end(etnaviv);
+
+	return TRUE;
+
+ fail:
+	if (stage)
+		etnaviv_de_end(etnaviv);
+	return FALSE;
 }
 
 static void
@@ -1388,6 +2569,7 @@ etnaviv_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
 	Bool ret;
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
 	if (!etnaviv->force_fallback) {
 		ret = etnaviv_accel_Composite(op, pSrc, pMask, pDst,
 					      xSrc, ySrc, xMask, yMask,
@@ -1395,8 +2577,22 @@ etnaviv_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
 		if (ret)
 			return;
 	}
-	unaccel_Composite(op, pSrc, pMask, pDst, xSrc, ySrc,
-			  xMask, yMask, xDst, yDst, width, height);
+	etnaviv_fallback_run(etnaviv, FB_OP_COMPOSITE,
+		unaccel_Composite(op, pSrc, pMask, pDst, xSrc, ySrc,
+				  xMask, yMask, xDst, yDst, width, height));
+}
+
+static void etnaviv_CompositeRects(CARD8 op, PicturePtr pDst,
+	xRenderColor *color, int nRect, xRectangle *rects)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
+
+	etnaviv->fallback.reason = FB_UNKNOWN;
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_CompositeRects(op, pDst, color, nRect, rects))
+		etnaviv_fallback_run(etnaviv, FB_OP_COMPOSITE_RECTS,
+			etnaviv->CompositeRects(op, pDst, color, nRect,
+						rects));
 }
 
 static void etnaviv_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
@@ -1405,11 +2601,182 @@ static void etnaviv_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
 
+	etnaviv->fallback.reason = FB_UNKNOWN;
 	if (etnaviv->force_fallback ||
 	    !etnaviv_accel_Glyphs(op, pSrc, pDst, maskFormat,
 				  xSrc, ySrc, nlist, list, glyphs))
-		unaccel_Glyphs(op, pSrc, pDst, maskFormat,
-			       xSrc, ySrc, nlist, list, glyphs);
+		etnaviv_fallback_run(etnaviv, FB_OP_GLYPHS,
+			unaccel_Glyphs(op, pSrc, pDst, maskFormat,
+				       xSrc, ySrc, nlist, list, glyphs));
+}
+
+/*
+ * Trapezoids and triangles are rasterised into an A8 mask by the CPU
+ * using pixman.  The mask is a new pixmap, so this does not need to
+ * wait for the GPU, and the final composite onto the destination is
+ * done by the GPU, leaving the destination with the GPU.
+ */
+struct etnaviv_raster {
+	PicturePtr pMask;
+	PixmapPtr pPixmap;
+	pixman_image_t *image;
+	BoxRec bounds;
+};
+
+static Bool etnaviv_raster_start(struct etnaviv_raster *r, PicturePtr pDst,
+	PictFormatPtr maskFormat, const BoxRec *bounds)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	DrawablePtr pDrawable = pDst->pDrawable;
+	BoxRec clip = *RegionExtents(pDst->pCompositeClip);
+	int width, height, error, y;
+	uint8_t *ptr;
+
+	r->pMask = NULL;
+	etnaviv->fallback.reason = FB_UNKNOWN;
+
+	if (etnaviv->force_fallback)
+		return FALSE;
+
+	if (!maskFormat || maskFormat->format != PICT_a8)
+		return etnaviv_fallback(etnaviv, FB_FORMAT);
+
+	if (!etnaviv_drawable(pDrawable))
+		return etnaviv_fallback(etnaviv, FB_NO_GPU);
+
+	/* Only rasterise what can be seen */
+	clip.x1 -= pDrawable->x;
+	clip.y1 -= pDrawable->y;
+	clip.x2 -= pDrawable->x;
+	clip.y2 -= pDrawable->y;
+	if (__box_intersect(&r->bounds, bounds, &clip))
+		return TRUE;
+
+	width = r->bounds.x2 - r->bounds.x1;
+	height = r->bounds.y2 - r->bounds.y1;
+
+	r->pPixmap = pScreen->CreatePixmap(pScreen, width, height,
+					   maskFormat->depth,
+					   CREATE_PIXMAP_USAGE_GPU);
+	if (!r->pPixmap)
+		return etnaviv_fallback(etnaviv, FB_NO_MEMORY);
+
+	r->pMask = CreatePicture(0, &r->pPixmap->drawable, maskFormat, 0, 0,
+				 serverClient, &error);
+	if (!r->pMask) {
+		pScreen->DestroyPixmap(r->pPixmap);
+		return etnaviv_fallback(etnaviv, FB_NO_MEMORY);
+	}
+
+	prepare_cpu_drawable(&r->pPixmap->drawable, CPU_ACCESS_RW);
+
+	ptr = r->pPixmap->devPrivate.ptr;
+	for (y = 0; y < height; y++, ptr += r->pPixmap->devKind)
+		memset(ptr, 0, width);
+
+	r->image = pixman_image_create_bits(PIXMAN_a8, width, height,
+					    r->pPixmap->devPrivate.ptr,
+					    r->pPixmap->devKind);
+	if (!r->image) {
+		finish_cpu_drawable(&r->pPixmap->drawable, CPU_ACCESS_RW);
+		FreePicture(r->pMask, 0);
+		pScreen->DestroyPixmap(r->pPixmap);
+		return etnaviv_fallback(etnaviv, FB_NO_MEMORY);
+	}
+
+	return TRUE;
+}
+
+static void etnaviv_raster_end(struct etnaviv_raster *r, CARD8 op,
+	PicturePtr pSrc, PicturePtr pDst, INT16 xSrc, INT16 ySrc)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+
+	pixman_image_unref(r->image);
+	finish_cpu_drawable(&r->pPixmap->drawable, CPU_ACCESS_RW);
+
+	CompositePicture(op, pSrc, r->pMask, pDst,
+			 xSrc + r->bounds.x1, ySrc + r->bounds.y1, 0, 0,
+			 r->bounds.x1, r->bounds.y1,
+			 r->bounds.x2 - r->bounds.x1,
+			 r->bounds.y2 - r->bounds.y1);
+
+	FreePicture(r->pMask, 0);
+	pScreen->DestroyPixmap(r->pPixmap);
+}
+
+static void etnaviv_Trapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntrap,
+	xTrapezoid *traps)
+{
+	struct etnaviv_raster r;
+	BoxRec bounds;
+
+	if (ntrap == 0)
+		return;
+
+	miTrapezoidBounds(ntrap, traps, &bounds);
+	if (bounds.y1 >= bounds.y2 || bounds.x1 >= bounds.x2)
+		return;
+
+	if (!etnaviv_raster_start(&r, pDst, maskFormat, &bounds)) {
+		struct etnaviv *etnaviv =
+			etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
+
+		etnaviv_fallback_run(etnaviv, FB_OP_TRAPEZOIDS,
+			unaccel_Trapezoids(op, pSrc, pDst, maskFormat,
+					   xSrc, ySrc, ntrap, traps));
+		return;
+	}
+
+	/* Nothing visible */
+	if (!r.pMask)
+		return;
+
+	/* xTrapezoid and pixman_trapezoid_t have the same layout */
+	pixman_add_trapezoids(r.image, -r.bounds.x1, -r.bounds.y1, ntrap,
+			      (pixman_trapezoid_t *)traps);
+
+	etnaviv_raster_end(&r, op, pSrc, pDst,
+			   xSrc - (traps[0].left.p1.x >> 16),
+			   ySrc - (traps[0].left.p1.y >> 16));
+}
+
+static void etnaviv_Triangles(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntri,
+	xTriangle *tris)
+{
+	struct etnaviv_raster r;
+	BoxRec bounds;
+
+	if (ntri == 0)
+		return;
+
+	miTriangleBounds(ntri, tris, &bounds);
+	if (bounds.y1 >= bounds.y2 || bounds.x1 >= bounds.x2)
+		return;
+
+	if (!etnaviv_raster_start(&r, pDst, maskFormat, &bounds)) {
+		struct etnaviv *etnaviv =
+			etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
+
+		etnaviv_fallback_run(etnaviv, FB_OP_TRIANGLES,
+			unaccel_Triangles(op, pSrc, pDst, maskFormat,
+					  xSrc, ySrc, ntri, tris));
+		return;
+	}
+
+	if (!r.pMask)
+		return;
+
+	/* xTriangle and pixman_triangle_t have the same layout */
+	pixman_add_triangles(r.image, -r.bounds.x1, -r.bounds.y1, ntri,
+			     (pixman_triangle_t *)tris);
+
+	etnaviv_raster_end(&r, op, pSrc, pDst,
+			   xSrc - (tris[0].p1.x >> 16),
+			   ySrc - (tris[0].p1.y >> 16));
 }
 
 static void etnaviv_UnrealizeGlyph(ScreenPtr pScreen, GlyphPtr glyph)
@@ -1463,6 +2830,9 @@ void etnaviv_render_screen_init(ScreenPtr pScreen)
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
 
+	etnaviv_filter_init();
+	xorg_list_init(&etnaviv->gradient_lru);
+
 	if (!etnaviv->force_fallback) {
 		etnaviv->CreateScreenResources = pScreen->CreateScreenResources;
 		pScreen->CreateScreenResources = etnaviv_CreateScreenResources;
@@ -1470,14 +2840,16 @@ void etnaviv_render_screen_init(ScreenPtr pScreen)
 
 	etnaviv->Composite = ps->Composite;
 	ps->Composite = etnaviv_Composite;
+	etnaviv->CompositeRects = ps->CompositeRects;
+	ps->CompositeRects = etnaviv_CompositeRects;
 	etnaviv->Glyphs = ps->Glyphs;
 	ps->Glyphs = etnaviv_Glyphs;
 	etnaviv->UnrealizeGlyph = ps->UnrealizeGlyph;
 	ps->UnrealizeGlyph = etnaviv_UnrealizeGlyph;
 	etnaviv->Triangles = ps->Triangles;
-	ps->Triangles = unaccel_Triangles;
+	ps->Triangles = etnaviv_Triangles;
 	etnaviv->Trapezoids = ps->Trapezoids;
-	ps->Trapezoids = unaccel_Trapezoids;
+	ps->Trapezoids = etnaviv_Trapezoids;
 	etnaviv->AddTriangles = ps->AddTriangles;
 	ps->AddTriangles = unaccel_AddTriangles;
 	etnaviv->AddTraps = ps->AddTraps;
@@ -1489,8 +2861,17 @@ void etnaviv_render_close_screen(ScreenPtr pScreen)
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
 
+	etnaviv_gradient_cache_fini(pScreen);
+	etnaviv_glyph_stage_fini(etnaviv);
+
+	if (etnaviv->solid_pixmap) {
+		pScreen->DestroyPixmap(etnaviv->solid_pixmap);
+		etnaviv->solid_pixmap = NULL;
+	}
+
 	/* Restore the Pointers */
 	ps->Composite = etnaviv->Composite;
+	ps->CompositeRects = etnaviv->CompositeRects;
 	ps->Glyphs = etnaviv->Glyphs;
 	ps->UnrealizeGlyph = etnaviv->UnrealizeGlyph;
 	ps->Triangles = etnaviv->Triangles;
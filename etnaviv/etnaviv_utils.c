@@ -122,6 +122,7 @@ Bool etnaviv_map_gpu(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix,
 	} else {
 		state = ST_GPU_R | ST_GPU_W;
 		mask = ST_CPU_R | ST_CPU_W | ST_GPU_R | ST_GPU_W;
+		vPix->serial++;
 	}
 
 	/* If the pixmap is already appropriately mapped, just return */
@@ -247,6 +248,8 @@ void prepare_cpu_drawable(DrawablePtr pDrawable, int access)
 #ifdef DEBUG_CHECK_DRAWABLE_USE
 		vPix->in_use++;
 #endif
+		if (access == CPU_ACCESS_RW)
+			vPix->serial++;
 		vPix->state |= access == CPU_ACCESS_RW ? ST_CPU_RW : ST_CPU_R;
 	}
 }
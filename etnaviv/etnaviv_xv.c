@@ -13,13 +13,18 @@
 #include "config.h"
 #endif
 
+#include <string.h>
 #include <sys/mman.h>
 
 #include "xf86.h"
 #include "xf86Crtc.h"
 #include "xf86xv.h"
 #include "damage.h"
+#include "resource.h"
 #include <X11/extensions/Xv.h>
+#ifdef MITSHM
+#include "shmint.h"
+#endif
 
 #include "boxutil.h"
 #include "compat-api.h"
@@ -34,6 +39,7 @@
 #include "common_drm_helper.h"
 
 #include "etnaviv_accel.h"
+#include "etnaviv_filter.h"
 #include "etnaviv_op.h"
 #include "etnaviv_utils.h"
 #include "etnaviv_xv.h"
@@ -50,6 +56,24 @@
 #define ETNAVIV_XV_MAX_WIDTH  4096
 #define ETNAVIV_XV_MAX_HEIGHT 4096
 
+/* Number of frames each port may have queued on the GPU */
+#define ETNAVIV_XV_FRAMES	3
+
+/* Number of client buffer imports each port keeps */
+#define ETNAVIV_XV_USERPTRS	8
+
+/* Source pixels read by the filter either side of the sample */
+#define ETNAVIV_XV_TAPS		4
+
+/*
+ * Stage 1 buffers are shared by all ports, in power of two sizes
+ * from 64KiB to 64MiB, enough for a 4k x 4k 32bpp intermediate.
+ * Buffers unused for ETNAVIV_XV_POOL_IDLE milliseconds are freed.
+ */
+#define ETNAVIV_XV_POOL_MIN_SHIFT	16
+#define ETNAVIV_XV_POOL_BUCKETS		11
+#define ETNAVIV_XV_POOL_IDLE		5000
+
 static XF86VideoEncodingRec etnaviv_encodings[] = {
 	{
 		.id = 0,
@@ -132,20 +156,63 @@ static const struct xv_image_format etnaviv_image_formats[] = {
 	},
 };
 
-#define KERNEL_ROWS	17
-#define KERNEL_INDICES	9
-#define KERNEL_SIZE	(KERNEL_ROWS * KERNEL_INDICES)
-#define KERNEL_STATE_SZ	((KERNEL_SIZE + 1) / 2)
-
-static uint32_t xv_filter_kernel[KERNEL_STATE_SZ];
-
 enum {
 	attr_sync_to_vblank,
+	attr_filter,
 	attr_last_prop,
 	attr_pipe = attr_last_prop,
 	attr_encoding,
 };
 
+/*
+ * A frame queued on the GPU.  The source is either an import of the
+ * client's buffer, which is released when the GPU has finished with
+ * it, or a copy of the image in this frame's staging buffer.
+ */
+struct etnaviv_xv_frame {
+	struct etnaviv_fence fence;
+	struct etna_bo *usr;
+	struct etna_bo *stage_bo;
+	void *stage_ptr;
+	size_t stage_size;
+};
+
+/*
+ * An import of a client's shared memory buffer.  Players cycle through
+ * a few buffers, so rather than pinning and mapping the pages for each
+ * frame, imports are kept until the segment is detached.  An import
+ * dropped while the GPU is using it is released when it retires.
+ */
+struct etnaviv_xv_userptr {
+	struct etnaviv_fence fence;
+	struct xorg_list node;
+	struct etna_bo *bo;
+	uintptr_t addr;
+	size_t size;
+	Bool stale;
+};
+
+struct etnaviv_xv_stage {
+	struct etnaviv_fence fence;
+	struct xorg_list node;
+	struct etna_bo *bo;
+	unsigned bucket;
+	CARD32 last_use;
+};
+
+struct etnaviv_xv_pool {
+	struct etnaviv *etnaviv;
+	struct xorg_list free[ETNAVIV_XV_POOL_BUCKETS];
+	OsTimerPtr timer;
+	size_t allocated;
+	size_t high_water;
+};
+
+static inline size_t etnaviv_xv_bucket_size(unsigned bucket)
+{
+	return (size_t)1 << (bucket + ETNAVIV_XV_POOL_MIN_SHIFT);
+}
+
 struct etnaviv_xv_priv {
 	struct etnaviv *etnaviv;
 	xf86CrtcPtr desired_crtc;
@@ -160,9 +227,14 @@ struct etnaviv_xv_priv {
 
 	struct etnaviv_format source_format;
 	struct etnaviv_format stage1_format;
-	uint32_t stage1_pitch;
-	size_t stage1_size;
-	struct etna_bo *stage1_bo;
+	unsigned stage1_bpp;
+	size_t stage1_high_water;
+
+	struct etnaviv_xv_frame frames[ETNAVIV_XV_FRAMES];
+	unsigned frame_next;
+
+	struct xorg_list userptrs;
+	unsigned num_userptrs;
 
 	INT32 props[attr_last_prop];
 };
@@ -186,6 +258,12 @@ static XF86AttributeRec etnaviv_xv_attributes[] = {
 		.max_value = 1,
 		.name = "XV_SYNC_TO_VBLANK",
 	},
+	[attr_filter] = {
+		.flags = XvSettable | XvGettable,
+		.min_value = 0,
+		.max_value = ETNAVIV_NUM_FILTERS - 1,
+		.name = "XV_FILTER",
+	},
 };
 
 static int etnaviv_xv_set_encoding(ScrnInfoPtr pScrn,
@@ -270,6 +348,12 @@ static struct xv_attr_data etnaviv_attributes[] = {
 		.get = etnaviv_xv_get_prop,
 		.attr = &etnaviv_xv_attributes[attr_sync_to_vblank],
 	},
+	[attr_filter] = {
+		.id = attr_filter,
+		.set = etnaviv_xv_set_prop,
+		.get = etnaviv_xv_get_prop,
+		.attr = &etnaviv_xv_attributes[attr_filter],
+	},
 };
 
 static const struct xv_image_format *etnaviv_get_fmt_xv(int id)
@@ -330,49 +414,404 @@ static int etnaviv_get_fmt_info(const struct xv_image_format *fmt,
 	return ALIGN(ret, getpagesize());
 }
 
-static Bool etnaviv_realloc_stage1(ScrnInfoPtr pScrn,
+static void etnaviv_xv_stage_retire(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+}
+
+static void etnaviv_xv_stage_free(struct etnaviv_xv_pool *pool,
+	struct etnaviv_xv_stage *stage)
+{
+	xorg_list_del(&stage->node);
+	pool->allocated -= etnaviv_xv_bucket_size(stage->bucket);
+	etna_bo_del(pool->etnaviv->conn, stage->bo, NULL);
+	free(stage);
+}
+
+/*
+ * Free the buffers which the GPU has finished with and which have
+ * not been used for idle milliseconds.  Returns TRUE if any buffers
+ * remain in the pool.
+ */
+static Bool etnaviv_xv_pool_trim(struct etnaviv_xv_pool *pool, CARD32 now,
+	CARD32 idle)
+{
+	struct etnaviv_xv_stage *stage, *n;
+	Bool remain = FALSE;
+	unsigned i;
+
+	for (i = 0; i < ETNAVIV_XV_POOL_BUCKETS; i++) {
+		xorg_list_for_each_entry_safe(stage, n, &pool->free[i], node) {
+			if (stage->fence.state == B_NONE &&
+			    now - stage->last_use >= idle)
+				etnaviv_xv_stage_free(pool, stage);
+			else
+				remain = TRUE;
+		}
+	}
+
+	return remain;
+}
+
+static CARD32 etnaviv_xv_pool_expire(OsTimerPtr timer, CARD32 time,
+	pointer arg)
+{
+	struct etnaviv_xv_pool *pool = arg;
+
+	if (etnaviv_xv_pool_trim(pool, time, ETNAVIV_XV_POOL_IDLE))
+		return ETNAVIV_XV_POOL_IDLE;
+
+	return 0;
+}
+
+/*
+ * Get a stage 1 buffer of at least size bytes from the pool shared by
+ * all ports.  The GPU executes our operations in order, so a buffer
+ * may be reused while earlier operations using it are still queued.
+ */
+static struct etnaviv_xv_stage *etnaviv_xv_stage_get(
 	struct etnaviv_xv_priv *priv, size_t size)
 {
-	struct etnaviv *etnaviv = priv->etnaviv;
+	struct etnaviv_xv_pool *pool = priv->etnaviv->xv_pool;
+	struct etnaviv *etnaviv = pool->etnaviv;
+	struct etnaviv_xv_stage *stage;
+	struct etna_bo *bo;
+	unsigned bucket;
+
+	for (bucket = 0; bucket < ETNAVIV_XV_POOL_BUCKETS; bucket++)
+		if (etnaviv_xv_bucket_size(bucket) >= size)
+			break;
+	if (bucket >= ETNAVIV_XV_POOL_BUCKETS)
+		return NULL;
+
+	if (priv->stage1_high_water < size)
+		priv->stage1_high_water = size;
+
+	if (!xorg_list_is_empty(&pool->free[bucket])) {
+		stage = xorg_list_first_entry(&pool->free[bucket],
+					      struct etnaviv_xv_stage, node);
+		xorg_list_del(&stage->node);
+		return stage;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
 
-	if (priv->stage1_bo)
-		etna_bo_del(etnaviv->conn, priv->stage1_bo, NULL);
+	size = etnaviv_xv_bucket_size(bucket);
 
 	/*
 	 * We don't need this bo mapped into this process at all, but
 	 * etnaviv and galcore gives us no option.
 	 */
-	priv->stage1_bo = etna_bo_new(etnaviv->conn, size,
-				      DRM_ETNA_GEM_TYPE_BMP |
-				      DRM_ETNA_GEM_CACHE_WBACK);
-	if (!priv->stage1_bo) {
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+	bo = etna_bo_new(etnaviv->conn, size,
+			 DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WBACK);
+	if (!bo) {
+		/* Release all idle buffers and try again */
+		etnaviv_xv_pool_trim(pool, GetTimeInMillis(), 0);
+		bo = etna_bo_new(etnaviv->conn, size,
+				 DRM_ETNA_GEM_TYPE_BMP |
+				 DRM_ETNA_GEM_CACHE_WBACK);
+	}
+	if (!bo) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
 			   "etnaviv Xv: etna_bo_new(size=%zu) failed\n", size);
-		priv->stage1_size = 0;
-		return FALSE;
+		free(stage);
+		return NULL;
+	}
+
+	stage->bo = bo;
+	stage->bucket = bucket;
+	stage->fence.retire = etnaviv_xv_stage_retire;
+	xorg_list_init(&stage->node);
+
+	pool->allocated += size;
+	if (pool->high_water < pool->allocated)
+		pool->high_water = pool->allocated;
+
+	return stage;
+}
+
+/* Return a stage 1 buffer, fenced for the current batch, to the pool */
+static void etnaviv_xv_stage_put(struct etnaviv_xv_pool *pool,
+	struct etnaviv_xv_stage *stage)
+{
+	struct etnaviv *etnaviv = pool->etnaviv;
+
+	etnaviv_fence_add(&etnaviv->fence_head, &stage->fence);
+	stage->last_use = GetTimeInMillis();
+	xorg_list_add(&stage->node, &pool->free[stage->bucket]);
+
+	pool->timer = TimerSet(pool->timer, 0, ETNAVIV_XV_POOL_IDLE,
+			       etnaviv_xv_pool_expire, pool);
+}
+
+static struct etnaviv_xv_pool *etnaviv_xv_pool_init(struct etnaviv *etnaviv)
+{
+	struct etnaviv_xv_pool *pool;
+	unsigned i;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool) {
+		pool->etnaviv = etnaviv;
+		for (i = 0; i < ETNAVIV_XV_POOL_BUCKETS; i++)
+			xorg_list_init(&pool->free[i]);
+	}
+
+	return pool;
+}
+
+static void etnaviv_xv_pool_fini(struct etnaviv_xv_pool *pool)
+{
+	struct etnaviv_xv_stage *stage, *n;
+	unsigned i;
+
+	TimerFree(pool->timer);
+
+	for (i = 0; i < ETNAVIV_XV_POOL_BUCKETS; i++) {
+		xorg_list_for_each_entry_safe(stage, n, &pool->free[i], node) {
+			etnaviv_fence_wait(pool->etnaviv, &stage->fence);
+			etnaviv_xv_stage_free(pool, stage);
+		}
 	}
 
-	priv->stage1_size = size;
+	free(pool);
+}
+
+static void etnaviv_xv_frame_retire(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+	struct etnaviv *etnaviv = container_of(fh, struct etnaviv, fence_head);
+	struct etnaviv_xv_frame *frame = container_of(f,
+					struct etnaviv_xv_frame, fence);
+
+	if (frame->usr) {
+		etna_bo_del(etnaviv->conn, frame->usr, NULL);
+		frame->usr = NULL;
+	}
+}
+
+/*
+ * Get the next frame for this port.  If every frame is still queued
+ * on the GPU, wait for the oldest to complete.
+ */
+static struct etnaviv_xv_frame *etnaviv_xv_get_frame(
+	struct etnaviv_xv_priv *priv)
+{
+	struct etnaviv_xv_frame *frame;
+	unsigned i;
+
+	for (i = 0; i < ETNAVIV_XV_FRAMES; i++) {
+		frame = &priv->frames[priv->frame_next];
+		priv->frame_next = (priv->frame_next + 1) % ETNAVIV_XV_FRAMES;
+		if (frame->fence.state == B_NONE)
+			break;
+	}
+
+	etnaviv_fence_wait(priv->etnaviv, &frame->fence);
+
+	return frame;
+}
+
+/* Copy the image into the frame's staging buffer */
+static Bool etnaviv_xv_frame_stage(ScrnInfoPtr pScrn,
+	struct etnaviv_xv_priv *priv, struct etnaviv_xv_frame *frame,
+	const unsigned char *buf)
+{
+	struct etnaviv *etnaviv = priv->etnaviv;
+
+	if (frame->stage_size < priv->size) {
+		if (frame->stage_bo)
+			etna_bo_del(etnaviv->conn, frame->stage_bo, NULL);
+		frame->stage_ptr = NULL;
+		frame->stage_size = 0;
+
+		frame->stage_bo = etna_bo_new(etnaviv->conn, priv->size,
+					      DRM_ETNA_GEM_TYPE_BMP);
+		if (!frame->stage_bo) {
+			xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+				   "etnaviv Xv: etna_bo_new(size=%zu) failed\n",
+				   priv->size);
+			return FALSE;
+		}
+
+		frame->stage_ptr = etna_bo_map(frame->stage_bo);
+		if (!frame->stage_ptr) {
+			etna_bo_del(etnaviv->conn, frame->stage_bo, NULL);
+			frame->stage_bo = NULL;
+			return FALSE;
+		}
+
+		frame->stage_size = priv->size;
+	}
+
+	memcpy(frame->stage_ptr, buf, priv->size);
+
 	return TRUE;
 }
 
-static void etnaviv_del_stage1(struct etnaviv_xv_priv *priv)
+static void etnaviv_xv_del_frames(struct etnaviv_xv_priv *priv)
+{
+	struct etnaviv *etnaviv = priv->etnaviv;
+	unsigned i;
+
+	for (i = 0; i < ETNAVIV_XV_FRAMES; i++) {
+		struct etnaviv_xv_frame *frame = &priv->frames[i];
+
+		etnaviv_fence_wait(etnaviv, &frame->fence);
+
+		if (frame->stage_bo) {
+			etna_bo_del(etnaviv->conn, frame->stage_bo, NULL);
+			frame->stage_bo = NULL;
+			frame->stage_ptr = NULL;
+			frame->stage_size = 0;
+		}
+	}
+}
+
+static void etnaviv_xv_userptr_free(struct etnaviv *etnaviv,
+	struct etnaviv_xv_userptr *u)
+{
+	etna_bo_del(etnaviv->conn, u->bo, NULL);
+	free(u);
+}
+
+static void etnaviv_xv_userptr_retire(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+	struct etnaviv *etnaviv = container_of(fh, struct etnaviv, fence_head);
+	struct etnaviv_xv_userptr *u = container_of(f,
+					struct etnaviv_xv_userptr, fence);
+
+	if (u->stale)
+		etnaviv_xv_userptr_free(etnaviv, u);
+}
+
+static void etnaviv_xv_userptr_drop(struct etnaviv_xv_priv *priv,
+	struct etnaviv_xv_userptr *u)
+{
+	xorg_list_del(&u->node);
+	priv->num_userptrs--;
+
+	if (u->fence.state == B_NONE)
+		etnaviv_xv_userptr_free(priv->etnaviv, u);
+	else
+		u->stale = TRUE;
+}
+
+/* Drop the imports which overlap the address range start..end */
+static void etnaviv_xv_userptr_invalidate(struct etnaviv_xv_priv *priv,
+	uintptr_t start, uintptr_t end)
+{
+	struct etnaviv_xv_userptr *u, *n;
+
+	xorg_list_for_each_entry_safe(u, n, &priv->userptrs, node)
+		if (u->addr < end && u->addr + u->size > start)
+			etnaviv_xv_userptr_drop(priv, u);
+}
+
+/*
+ * Look up the import of a client buffer, creating it if necessary.
+ * The import is fenced for use by the current batch.  Caching only
+ * saves re-importing the buffer: the caller must still wait for the
+ * GPU to finish with it before the client may reuse the buffer.
+ */
+static struct etna_bo *etnaviv_xv_userptr_get(struct etnaviv_xv_priv *priv,
+	void *addr, size_t size)
 {
 	struct etnaviv *etnaviv = priv->etnaviv;
+	struct etnaviv_xv_userptr *u;
+
+	xorg_list_for_each_entry(u, &priv->userptrs, node) {
+		if (u->addr == (uintptr_t)addr && u->size == size) {
+			/* Keep the most recently used import first */
+			xorg_list_del(&u->node);
+			xorg_list_add(&u->node, &priv->userptrs);
+
+			/*
+			 * The kernel only cleans the CPU cache for the pages
+			 * when the import is made.  The client has since
+			 * written a new image, so clean it again before the
+			 * GPU reads it.
+			 */
+			etna_bo_cpu_prep(u->bo, NULL, DRM_ETNA_PREP_READ);
+			etna_bo_cpu_fini(u->bo);
+			goto found;
+		}
+	}
+
+	if (priv->num_userptrs >= ETNAVIV_XV_USERPTRS)
+		etnaviv_xv_userptr_drop(priv,
+			xorg_list_last_entry(&priv->userptrs,
+					     struct etnaviv_xv_userptr, node));
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return NULL;
 
-	if (priv->stage1_bo) {
-		etna_bo_del(etnaviv->conn, priv->stage1_bo, NULL);
-		priv->stage1_bo = NULL;
-		priv->stage1_size = 0;
+	u->bo = etna_bo_from_usermem_prot(etnaviv->conn, addr, size,
+					  PROT_READ);
+	if (!u->bo) {
+		free(u);
+		return NULL;
 	}
+
+	u->addr = (uintptr_t)addr;
+	u->size = size;
+	u->fence.retire = etnaviv_xv_userptr_retire;
+	xorg_list_add(&u->node, &priv->userptrs);
+	priv->num_userptrs++;
+
+ found:
+	etnaviv_fence_add(&etnaviv->fence_head, &u->fence);
+
+	return u->bo;
 }
 
+#ifdef MITSHM
+/*
+ * A shared memory segment is going away, either because the client
+ * detached it or because the client has gone.  Its pages may be
+ * replaced by another mapping, so drop any imports of it.
+ */
+static void etnaviv_xv_resource_state(CallbackListPtr *list,
+	pointer user_data, pointer call_data)
+{
+	struct etnaviv *etnaviv = user_data;
+	ResourceStateInfoRec *rec = call_data;
+	ShmDescPtr shmdesc;
+	uintptr_t start;
+	unsigned i;
+
+	if (rec->state != ResourceStateFreeing)
+		return;
+
+	if (!etnaviv->xv_shm_type) {
+		const char *name = LookupResourceName(rec->type);
+
+		if (!name || strcmp(name, "ShmSeg"))
+			return;
+		etnaviv->xv_shm_type = rec->type;
+	} else if (rec->type != etnaviv->xv_shm_type) {
+		return;
+	}
+
+	shmdesc = rec->value;
+	start = (uintptr_t)shmdesc->addr;
+
+	for (i = 0; i < etnaviv->xv_ports; i++)
+		etnaviv_xv_userptr_invalidate(&etnaviv->xv[i], start,
+					      start + shmdesc->size);
+}
+#endif
+
 static void etnaviv_StopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown)
 {
 	struct etnaviv_xv_priv *priv = data;
 
 	if (shutdown) {
-		etnaviv_del_stage1(priv);
+		etnaviv_xv_userptr_invalidate(priv, 0, UINTPTR_MAX);
+		etnaviv_xv_del_frames(priv);
 		priv->fmt = NULL;
 	}
 }
@@ -419,10 +858,8 @@ static int etnaviv_configure_format(struct etnaviv_xv_priv *priv,
 
 	priv->source_format = *(const struct etnaviv_format *)fmt->u.data;
 
-	/* Setup the stage 1 (vertical blit) pitch and format */
+	/* Setup the stage 1 (intermediate) pixel size and format */
 	if (fmt->xv_image.type != XvYUV) {
-		unsigned bpp;
-
 		/*
 		 * If the target has more bits per pixel, use that
 		 * as the intermediate format.  Otherwise, use the
@@ -430,12 +867,11 @@ static int etnaviv_configure_format(struct etnaviv_xv_priv *priv,
 		 */
 		if (drawable->bitsPerPixel > fmt->xv_image.bits_per_pixel) {
 			priv->stage1_format = vPix->format;
-			bpp = drawable->bitsPerPixel;
+			priv->stage1_bpp = drawable->bitsPerPixel;
 		} else {
 			priv->stage1_format = priv->source_format;
-			bpp = fmt->xv_image.bits_per_pixel;
+			priv->stage1_bpp = fmt->xv_image.bits_per_pixel;
 		}
-		priv->stage1_pitch = etnaviv_pitch(width, bpp);
 	} else if (VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20)) {
 		/*
 		 * Documentation (for example i.MX6 reference manual chapter
@@ -448,11 +884,10 @@ static int etnaviv_configure_format(struct etnaviv_xv_priv *priv,
 			priv->stage1_format = fmt_uyvy;
 		else
 			priv->stage1_format = fmt_yuy2;
-		priv->stage1_pitch = etnaviv_pitch(width, 16);
+		priv->stage1_bpp = 16;
 	} else {
 		priv->stage1_format = vPix->format;
-		priv->stage1_pitch = etnaviv_pitch(width,
-						   drawable->bitsPerPixel);
+		priv->stage1_bpp = drawable->bitsPerPixel;
 	}
 
 	return Success;
@@ -468,13 +903,16 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 	struct etnaviv *etnaviv = priv->etnaviv;
 	struct etnaviv_vr_op op;
 	struct etnaviv_pixmap *vPix;
-	struct etna_bo *usr;
+	struct etnaviv_xv_frame *frame;
+	struct etnaviv_xv_stage *stage = NULL;
+	struct etna_bo *src_bo;
 	drmVBlank vbl;
 	xf86CrtcPtr crtc;
 	BoxRec dst;
 	xPoint dst_offset;
 	INT32 x1, x2, y1, y2;
 	Bool is_xvbo = id == FOURCC_XVBO;
+	Bool scale_x, scale_y, vertical;
 	int s_w, s_h, xoff;
 
 	box_init(&dst, drw_x, drw_y, drw_w, drw_h);
@@ -524,39 +962,53 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 			crtc = NULL;
 	}
 
+	frame = etnaviv_xv_get_frame(priv);
+
 	if (is_xvbo) {
 		uint32_t name = ((uint32_t *)buf)[1];
 
-		usr = etna_bo_from_name(etnaviv->conn, name);
-		if (!usr)
+		frame->usr = etna_bo_from_name(etnaviv->conn, name);
+		if (!frame->usr)
 			return BadAlloc;
 
-		if (etna_bo_size(usr) < priv->size) {
-			etna_bo_del(etnaviv->conn, usr, NULL);
-			return BadAlloc;
-		}
+		if (etna_bo_size(frame->usr) < priv->size)
+			goto bad_alloc;
 
+		src_bo = frame->usr;
 		xoff = 0;
-	} else {
-		/* The GPU alignment offset of the buffer. */
+	} else if (sync) {
+		/*
+		 * A shared memory image, which the GPU reads directly
+		 * through a cached import of the client's buffer.  We
+		 * wait for the GPU to finish reading it before returning.
+		 *
+		 * The GPU alignment offset of the buffer.
+		 */
 		xoff = (uintptr_t)buf & 63;
 
-		usr = etna_bo_from_usermem_prot(etnaviv->conn, buf - xoff,
-						priv->size + xoff, PROT_READ);
-		if (!usr)
+		src_bo = etnaviv_xv_userptr_get(priv, buf - xoff,
+						priv->size + xoff);
+		if (!src_bo)
 			return BadAlloc;
 
 		xoff = (xoff >> 1) << 16;
+	} else {
+		/*
+		 * The image is part of the client's request buffer, which
+		 * will be reused as soon as we return.  Copy it.
+		 */
+		if (!etnaviv_xv_frame_stage(pScrn, priv, frame, buf))
+			return BadAlloc;
+
+		src_bo = frame->stage_bo;
+		xoff = 0;
 	}
 
-	op.src = INIT_BLIT_BO(usr, 0, priv->source_format, ZERO_OFFSET);
+	op.src = INIT_BLIT_BO(src_bo, 0, priv->source_format, ZERO_OFFSET);
 	op.src_pitches = priv->pitches;
 	op.src_offsets = priv->offsets;
 	box_init(&op.src_bounds, xoff >> 16, 0, width, height);
 
-	etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0), KERNEL_STATE_SZ,
-			     xv_filter_kernel);
-
 	/*
 	 * The resulting width/height of the source/destination
 	 * after clipping etc.
@@ -566,63 +1018,143 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 	drw_w = box_width(&dst);
 	drw_h = box_height(&dst);
 
-	/* Check whether we need to scale in the vertical direction first. */
-	if (s_h != drw_h << 16) {
-		size_t stage1_size = priv->stage1_pitch;
+	/* A pass is not required for an axis which is not scaled */
+	scale_x = s_w != drw_w << 16;
+	scale_y = s_h != drw_h << 16;
+
+	if (scale_x && scale_y) {
+		unsigned r1, r2, stage1_w, stage1_h;
+		uint32_t stage1_pitch, h_pitch, v_pitch;
+		size_t stage1_size;
+		Bool h_first;
 		BoxRec box;
 
-		stage1_size *= drw_h;
+		/*
+		 * The first pass writes an intermediate image.  Scaling
+		 * vertically first gives source columns by destination
+		 * rows; horizontally first gives destination columns by
+		 * the source rows read by the vertical filter.  Do the
+		 * pass which produces the smaller intermediate first: a
+		 * large horizontal reduction favours horizontal first.
+		 */
+		r1 = y1 >> 16;
+		r1 = r1 > ETNAVIV_XV_TAPS ? r1 - ETNAVIV_XV_TAPS : 0;
+		r2 = min_t(unsigned, ((y2 + 0xffff) >> 16) + ETNAVIV_XV_TAPS,
+			   height);
+
+		v_pitch = etnaviv_pitch(width, priv->stage1_bpp);
+		h_pitch = etnaviv_pitch(ALIGN(drw_w, 2), priv->stage1_bpp);
+		h_first = (size_t)h_pitch * (r2 - r1) <
+			  (size_t)v_pitch * drw_h;
+
+		if (h_first) {
+			stage1_w = ALIGN(drw_w, 2);
+			stage1_h = r2 - r1;
+			stage1_pitch = h_pitch;
+		} else {
+			stage1_w = width;
+			stage1_h = drw_h;
+			stage1_pitch = v_pitch;
+		}
+
+		stage1_size = (size_t)stage1_pitch * stage1_h;
 
-		/* Check whether we need to reallocate the temporary bo */
-		if (stage1_size > priv->stage1_size &&
-		    !etnaviv_realloc_stage1(pScrn, priv, stage1_size))
+		stage = etnaviv_xv_stage_get(priv, stage1_size);
+		if (!stage)
 			goto bad_alloc;
 
-		box_init(&box, 0, 0, width, drw_h);
+		box_init(&box, 0, 0, stage1_w, stage1_h);
 
 		/*
-		 * Perform a vertical filter blit first, converting to
-		 * YUY2 format if supported and the source is in YUV,
-		 * otherwise keeping the original format.
+		 * The intermediate is converted to YUY2 format if
+		 * supported and the source is in YUV, otherwise it
+		 * keeps the original format.
 		 */
-		op.h_scale = 1 << 16;
-		op.v_scale = s_h / drw_h;
-		op.dst = INIT_BLIT_BO(priv->stage1_bo, priv->stage1_pitch,
+		op.dst = INIT_BLIT_BO(stage->bo, stage1_pitch,
 				      priv->stage1_format, ZERO_OFFSET);
-		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
-		op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
 
-		etnaviv_vr_op(etnaviv, &op, &box, xoff, y1, &box, 1);
+		if (h_first) {
+			op.h_scale = s_w / drw_w;
+			op.v_scale = 1 << 16;
+			op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+			op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+
+			etnaviv_filter_load(etnaviv, priv->props[attr_filter],
+					    op.h_scale);
+			etnaviv_vr_op(etnaviv, &op, &box, x1 + xoff, r1 << 16,
+				      &box, 1);
+
+			/*
+			 * The intermediate's columns are the destination
+			 * columns, and its first row is source row r1.
+			 */
+			x1 = 0;
+			y1 -= r1 << 16;
+			op.src_bounds = box;
+			vertical = TRUE;
+		} else {
+			op.h_scale = 1 << 16;
+			op.v_scale = s_h / drw_h;
+			op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
+			op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
+
+			etnaviv_filter_load(etnaviv, priv->props[attr_filter],
+					    op.v_scale);
+			etnaviv_vr_op(etnaviv, &op, &box, xoff, y1, &box, 1);
+
+			/*
+			 * We have already taken care of the Y offset on the
+			 * source image in the above vertical filter blit.
+			 */
+			y1 = 0;
+			box_init(&op.src_bounds, 0, 0, (x2 + 0xffff) >> 16,
+				 drw_h);
+			vertical = FALSE;
+		}
 		/* GC320 and GC600 do not seem to need a flush here */
 
 		/* Set the source for the next stage */
 		op.src = op.dst;
 		op.src_pitches = op.src_offsets = NULL;
-
-		/*
-		 * We have already taken care of the Y offset on the
-		 * source image in the above vertical filter blit.
-		 */
-		y1 = 0;
-
-		box_init(&op.src_bounds, 0, 0, (x2 + 0xffff) >> 16, drw_h);
 	} else {
-		/* No need for the vertical scaling stage. */
+		/* Only one pass is required, directly from the source. */
 		x1 += xoff;
 		x2 += xoff;
+		vertical = scale_y;
 	}
 
 	op.dst = INIT_BLIT_BO(vPix->etna_bo, vPix->pitch, vPix->format, dst_offset);
-	op.h_scale = s_w / drw_w;
-	op.v_scale = 1 << 16;
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
-	op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+	if (vertical) {
+		op.h_scale = 1 << 16;
+		op.v_scale = s_h / drw_h;
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
+		etnaviv_filter_load(etnaviv, priv->props[attr_filter],
+				    op.v_scale);
+	} else {
+		op.h_scale = s_w / drw_w;
+		op.v_scale = 1 << 16;
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+		etnaviv_filter_load(etnaviv, priv->props[attr_filter],
+				    op.h_scale);
+	}
 
-	/* Perform horizontal filter blt */
+	/* Perform the final filter blt to the destination */
 	etnaviv_vr_op(etnaviv, &op, &dst, x1, y1, RegionRects(clipBoxes),
 		      RegionNumRects(clipBoxes));
 	etnaviv_flush(etnaviv);
 
+	/*
+	 * Fence the frame's source and the destination, and submit the
+	 * work so that the GPU scales this frame while we wait for vsync.
+	 */
+	etnaviv_batch_add(etnaviv, vPix);
+	etnaviv_fence_add(&etnaviv->fence_head, &frame->fence);
+	if (stage)
+		etnaviv_xv_stage_put(etnaviv->xv_pool, stage);
+	etnaviv_commit(etnaviv, FALSE);
+
 	/* Wait for vsync */
 	if (crtc && priv->props[attr_sync_to_vblank]) {
 		vbl.request.sequence = vbl.reply.sequence + 1;
@@ -630,21 +1162,21 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 	}
 
 	/*
-	 * It would be nice not to wait for the GPU to finish rendering
-	 * here, but it seems we can't avoid it.  In theory, 'sync'
-	 * would tell us whether we can, but in the case of non-shmem,
-	 * that is always false, and the passed buffer is part of the
-	 * client specific request buffer on the server.
+	 * When sync is set, the client is told it may reuse the image
+	 * as soon as we return, so the GPU must have finished reading it.
 	 */
-	etna_finish(etnaviv->ctx);
+	if (sync)
+		etnaviv_fence_wait(etnaviv, &frame->fence);
 
-	etna_bo_del(etnaviv->conn, usr, NULL);
 	DamageDamageRegion(drawable, clipBoxes);
 
 	return Success;
 
  bad_alloc:
-	etna_bo_del(etnaviv->conn, usr, NULL);
+	if (frame->usr) {
+		etna_bo_del(etnaviv->conn, frame->usr, NULL);
+		frame->usr = NULL;
+	}
 
 	return BadAlloc;
 }
@@ -701,84 +1233,6 @@ static int etnaviv_QueryImageAttributes(ScrnInfoPtr pScrn, int id,
 	return ret;
 }
 
-static inline float sinc(float x)
-{
-	return x != 0.0 ? sinf(x) / x : 1.0;
-}
-
-/*
- * Some interesting observations of the kernel.  According to the etnaviv
- * rnndb files:
- *  - there are 128 states which hold the kernel.
- *  - each entry contains 9 coefficients (one for each filter tap).
- *  - the entries are indexed by 5 bits from the fractional coordinate
- *    (which makes 32 entries.)
- *
- * As the kernel table is symmetrical around the centre of the fractional
- * coordinate, only half of the entries need to be stored.  In other words,
- * these pairs of indices should be the same:
- *
- *  00=31 01=30 02=29 03=28 04=27 05=26 06=25 07=24
- *  08=23 09=22 10=21 11=20 12=19 13=18 14=17 15=16
- *
- * This means that there are only 16 entries.  However, etnaviv
- * documentation says 17 are required.  What's the additional entry?
- *
- * The next issue is that the filter code always produces zero for the
- * ninth filter tap.  If this is always zero, what's the point of having
- * hardware deal with nine filter taps?  This makes no sense to me.
- */
-static void etnaviv_init_filter_kernel(void)
-{
-	unsigned row, idx, i;
-	int16_t kernel_val[KERNEL_STATE_SZ * 2];
-	float row_ofs = 0.5;
-	float radius = 4.0;
-
-	/* Compute lanczos filter kernel */
-	for (row = i = 0; row < KERNEL_ROWS; row++) {
-		float kernel[KERNEL_INDICES] = { 0.0 };
-		float sum = 0.0;
-
-		for (idx = 0; idx < KERNEL_INDICES; idx++) {
-			float x = idx - 4.0 + row_ofs;
-
-			if (fabs(x) <= radius)
-				kernel[idx] = sinc(M_PI * x) *
-					      sinc(M_PI * x / radius);
-
-			sum += kernel[idx];
-		}
-
-		/* normalise the row */
-		if (sum)
-			for (idx = 0; idx < KERNEL_INDICES; idx++)
-				kernel[idx] /= sum;
-
-		/* convert to 1.14 format */
-		for (idx = 0; idx < KERNEL_INDICES; idx++) {
-			int val = kernel[idx] * (float)(1 << 14);
-
-			if (val < -0x8000)
-				val = -0x8000;
-			else if (val > 0x7fff)
-				val = 0x7fff;
-
-			kernel_val[i++] = val;
-		}
-
-		row_ofs -= 1.0 / ((KERNEL_ROWS - 1) * 2);
-	}
-
-	kernel_val[KERNEL_SIZE] = 0;
-
-	/* Now convert the kernel values into state values */
-	for (i = 0; i < KERNEL_STATE_SZ * 2; i += 2)
-		xv_filter_kernel[i / 2] =
-			VIVS_DE_FILTER_KERNEL_COEFFICIENT0(kernel_val[i]) |
-			VIVS_DE_FILTER_KERNEL_COEFFICIENT1(kernel_val[i + 1]);
-}
-
 static Bool etnaviv_xv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
@@ -786,11 +1240,33 @@ static Bool etnaviv_xv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	struct etnaviv_xv_priv *priv = etnaviv->xv;
 	unsigned i;
 
+#ifdef MITSHM
+	DeleteCallback(&ResourceStateCallback, etnaviv_xv_resource_state,
+		       etnaviv);
+#endif
+
 	if (priv) {
-		for (i = 0; i < etnaviv->xv_ports; i++)
+		for (i = 0; i < etnaviv->xv_ports; i++) {
 			etnaviv_StopVideo(pScrn, &priv[i], TRUE);
 
+			if (priv[i].stage1_high_water)
+				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+					   "etnaviv Xv: port %u stage 1 high water %zuKiB\n",
+					   i, priv[i].stage1_high_water >> 10);
+		}
+
 		free(priv);
+		etnaviv->xv = NULL;
+	}
+
+	if (etnaviv->xv_pool) {
+		if (etnaviv->xv_pool->high_water)
+			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				   "etnaviv Xv: stage 1 pool high water %zuKiB\n",
+				   etnaviv->xv_pool->high_water >> 10);
+
+		etnaviv_xv_pool_fini(etnaviv->xv_pool);
+		etnaviv->xv_pool = NULL;
 	}
 
 	pScreen->CloseScreen = etnaviv->xv_CloseScreen;
@@ -803,6 +1279,7 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	struct etnaviv_xv_priv *priv;
+	struct etnaviv_xv_pool *pool;
 	XF86VideoAdaptorPtr p;
 	XF86ImageRec *images;
 	DevUnion *devUnions;
@@ -818,7 +1295,7 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	}
 #endif
 
-	etnaviv_init_filter_kernel();
+	etnaviv_filter_init();
 
 	etnaviv_xv_attributes[attr_pipe].max_value =
 		XF86_CRTC_CONFIG_PTR(pScrn)->num_crtc - 1;
@@ -830,7 +1307,9 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	devUnions = calloc(nports, sizeof(*devUnions));
 	priv = calloc(nports, sizeof(*priv));
 	images = calloc(ARRAY_SIZE(etnaviv_image_formats), sizeof(*images));
-	if (!p || !devUnions || !priv || !images) {
+	pool = etnaviv_xv_pool_init(etnaviv);
+	if (!p || !devUnions || !priv || !images || !pool) {
+		free(pool);
 		free(images);
 		free(priv);
 		free(devUnions);
@@ -838,6 +1317,19 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 		return NULL;
 	}
 
+#ifdef MITSHM
+	/* Drop imports of shared memory segments as they go away */
+	if (!AddCallback(&ResourceStateCallback, etnaviv_xv_resource_state,
+			 etnaviv)) {
+		free(pool);
+		free(images);
+		free(priv);
+		free(devUnions);
+		free(p);
+		return NULL;
+	}
+#endif
+
 	for (num_images = i = 0; i < ARRAY_SIZE(etnaviv_image_formats); i++) {
 		const struct xv_image_format *fmt = &etnaviv_image_formats[i];
 		const struct etnaviv_format *f = fmt->u.data;
@@ -877,8 +1369,15 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	p->QueryImageAttributes = etnaviv_QueryImageAttributes;
 
 	for (i = 0; i < nports; i++) {
+		unsigned j;
+
 		priv[i].etnaviv = etnaviv;
 		priv[i].props[attr_sync_to_vblank] = 1;
+		priv[i].props[attr_filter] = ETNAVIV_FILTER_LANCZOS;
+		for (j = 0; j < ETNAVIV_XV_FRAMES; j++)
+			priv[i].frames[j].fence.retire =
+				etnaviv_xv_frame_retire;
+		xorg_list_init(&priv[i].userptrs);
 		p->pPortPrivates[i].ptr = (pointer) &priv[i];
 	}
 
@@ -890,6 +1389,8 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 
 	etnaviv->xv = priv;
 	etnaviv->xv_ports = nports;
+	etnaviv->xv_pool = pool;
+	etnaviv->xv_shm_type = 0;
 	etnaviv->xv_CloseScreen = pScreen->CloseScreen;
 	pScreen->CloseScreen = etnaviv_xv_CloseScreen;
 